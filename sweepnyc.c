@@ -1,8 +1,49 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #define N_EDGE_TYPES 4
+#define N_DIRECTIONS 4
 #define MAX_EVALUATIONS 4
+#define N_CALL_TYPES 3
+#define N_PHASES 4
+#define PHASE_PARSE 0
+#define PHASE_POLARITY 1
+#define PHASE_SETUP 2
+#define PHASE_SEARCH 3
+#define N_PRUNES 4
+#define PRUNE_DISTANCE1 0
+#define PRUNE_DISTANCE2 1
+#define PRUNE_BRANCH 2
+#define PRUNE_CANDIDATE 3
+#define N_BFS_CALLERS 4
+#define BFS_DISPATCH_CALL 0
+#define BFS_SET_DISTANCES 1
+#define BFS_ADD_PATH_CALLS2 2
+#define BFS_REDUCE_POLARITY 3
+#define CHECKPOINT_MAGIC "sweepnyc_checkpoint"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_SECONDS_DEFAULT 60
+#define CHECKPOINT_CHECK_CALLS 1024
+#define SHARED_BEST_CHECK_CALLS 1024
+#define N_PATHS_MIN 4
+#define BATCH_WORKERS_MAX 256
+#define BATCH_READ_SIZE 4096
+#define BFS_STAMP_MAX 0x7fffffff
+#define BFS_THREADS_WORK_MIN 65536
+#define DISTRICTS_MAX 256
+#define DISTRICT_SECONDS_DEFAULT 10
 
 typedef struct path_s path_t;
 typedef struct node_s node_t;
@@ -22,22 +63,25 @@ struct path_s {
 	int distance_next;
 	int to_start;
 	int distance_start;
-	path_t *last;
-	path_t *next;
+	path_t *next_pending;
 };
 
 struct node_s {
 	int street;
 	int avenue;
 	int n_to_paths;
+	int max_to_paths;
 	path_t *to_paths;
 	int polarity;
+	int arcs;
 	int n_from_paths;
+	int max_from_paths;
 	path_t **from_paths;
 	int n_visits;
 	int visited;
 	node_t *from;
 	int distance;
+	path_t *pending;
 };
 
 typedef struct {
@@ -56,6 +100,52 @@ typedef struct {
 }
 evaluation_t;
 
+typedef struct {
+	double start;
+	double phases[N_PHASES];
+	double first_circuit;
+	double best_circuit;
+	int n_circuits;
+	unsigned long calls[N_CALL_TYPES];
+	unsigned long prunes[N_PRUNES];
+	unsigned long bfs_expansions[N_BFS_CALLERS];
+}
+stats_t;
+
+typedef struct {
+	pid_t pid;
+	int jobs;
+	int results;
+	int instance;
+	char *output;
+	size_t output_size;
+	size_t output_max;
+}
+batch_worker_t;
+
+typedef struct {
+	int host;
+	int first;
+	int last;
+	int next;
+}
+detour_t;
+
+typedef struct {
+	pthread_t thread;
+	int index;
+	int stamp;
+	int *stamps;
+	int *distances;
+	node_t **queue;
+	unsigned long expansions;
+}
+bfs_thread_t;
+
+static int parse_int(const char *, int, int *);
+static int solve(void);
+static int set_search_arrays(void);
+static void search(node_t *);
 static int read_street(int);
 static int read_node(int, int);
 static int link_node(edge_t *, node_t *, int, int, int);
@@ -74,17 +164,21 @@ static void dispatch_call(int, node_t *, path_t *);
 static void add_bfs_paths(node_t *);
 static void add_bfs_path(path_t *);
 static void add_q_node2(node_t *);
-static int get_distance_next(node_t *, path_t *);
+static void set_bfs_distances(node_t *);
+static int merge_distance_next(path_t *);
 static void set_distances(node_t *, path_t *);
 static int add_distance_nodes1(node_t *);
 static int add_distance_node1(node_t *, path_t *);
 static void add_distance_nodes2(node_t *);
 static void add_distance_node2(node_t *, path_t *);
+static void add_distance_nodes3(node_t *);
+static int get_arc(const node_t *, const node_t *);
 static int get_delta(path_t *);
 static void add_q_node1(node_t *, node_t *);
 static void add_node_calls(node_t *, node_t *, int);
 static void add_path_calls1(path_t *);
 static void add_path_calls2(node_t *, path_t *, int);
+static void add_paths_calls2(node_t *, node_t *, int);
 static void add_q_node3(node_t *, node_t *);
 static void check_distance(path_t *, node_t *, int);
 static int add_target_nodes(node_t *, node_t *, void (*)(node_t *, node_t *));
@@ -94,7 +188,6 @@ static int add_to_path(node_t *, edge_t *, node_t *);
 static int add_from_path(path_t *);
 static void set_path(path_t *, node_t *, edge_t *, node_t *);
 static void reset_path(path_t *);
-static void link_paths(path_t *, path_t *);
 static void init_q_nodes(node_t *, int, int);
 static void reset_q_nodes(void);
 static void print_node(const node_t *);
@@ -107,78 +200,402 @@ static void set_evaluation(evaluation_t *, path_t *, int, int);
 static int compare_evaluations(const void *, const void *);
 static void free_data(void);
 static void free_node(node_t *);
+static double get_time(void);
+static double set_phase(int, double);
+static void add_expansions(int, int);
+static void write_stats_snapshot(void);
+static void write_stats_summary(int);
+static void write_stats_counters(void);
+static void write_stats_seconds(double);
+static void set_circuit(node_t *);
+static int walk_pending_paths(node_t **, node_t *, int);
+static void add_pending_path(path_t *);
+static void print_circuit(void);
+static void checkpoint_search(const node_t *);
+static int write_checkpoint(const node_t *);
+static void write_checkpoint_path(FILE *, const path_t *);
+static int read_checkpoint(const node_t *, path_t *);
+static int read_checkpoint_state(FILE *, const node_t *, path_t *);
+static int read_checkpoint_int(FILE *, int, int, int *);
+static int read_checkpoint_path(FILE *, path_t *, path_t **);
+static unsigned long get_city_checksum(void);
+static int read_delta(int);
+static int read_delta_edge(int, int, int, int, int, int);
+static int warm_start(node_t *);
+static int read_previous_circuit(FILE *);
+static int repair_circuit(node_t *);
+static int cover_path(path_t *, int *, int);
+static int add_detour(int, int);
+static int splice_detours(int);
+static void set_covered(node_t *, node_t *, int);
+static int add_shortest_path(node_t *, node_t *);
+static int add_repaired_node(node_t *);
+static path_t *get_path(node_t *, node_t *);
+static path_t *get_edge_path(node_t *, node_t *);
+static void set_incumbent(node_t **, int);
+static int orient_start(node_t *);
+static int orient_circuit(node_t *, int);
+static void orient_edge(node_t *, path_t *);
+static int reverse_edges(node_t *);
+static void add_reversible_nodes(node_t *);
+static int is_two_way(const path_t *);
+static int pair_odd_node(node_t *);
+static int add_deadhead_paths(node_t *);
+static int add_oriented_arc(node_t *, node_t *);
+static int search_all_starts(void);
+static int run_workers(int, pid_t *, FILE **, void (*)(int, FILE *), int (*)(int));
+static int write_start_jobs(int);
+static void search_starts(int, FILE *);
+static void write_worker_result(FILE *);
+static int read_worker_result(FILE *, int *, stats_t *);
+static void add_worker_stats(const stats_t *);
+static int solve_districts(node_t *);
+static void set_districts(int, int, int, int, int, int);
+static int get_rectangle_weight(int, int, int, int);
+static int get_district(const node_t *, const node_t *);
+static int is_required(const node_t *, const path_t *);
+static int write_district_jobs(int);
+static void search_district(int, FILE *);
+static int set_district_paths(int, node_t *);
+static int connect_district(node_t *);
+static void set_reached_nodes(node_t *, int *);
+static int add_tree_paths(node_t *, node_t *);
+static int stitch_district(node_t **, int, int *);
+static int get_lower_bound(void);
+static int improve_circuit(void);
+static int local_search(double);
+static void set_required_steps(int *);
+static int reroute_deadheads(const int *, double);
+static int reverse_segments(const int *, double);
+static int is_reversible(int, int);
+static int add_circuit_nodes(int, int);
+static int get_shortest_distance(node_t *, node_t *, int);
+static int solve_batch(void);
+static int give_batch_instances(batch_worker_t *);
+static int start_batch_worker(batch_worker_t *, int);
+static int run_batch_worker(int);
+static int read_batch_instance(void);
+static int copy_batch_token(long *);
+static int copy_batch_line(void);
+static int add_batch_char(int);
+static void send_batch_instance(batch_worker_t *, int);
+static int read_batch_output(batch_worker_t *);
+static int add_batch_output(batch_worker_t *, const char *, size_t);
+static int end_batch_crashed(batch_worker_t *);
+static void end_batch_instance(batch_worker_t *);
+static void stop_batch_worker(batch_worker_t *);
+static void print_batch_outputs(void);
+static int read_fd(int, void *, size_t);
+static int write_fd(int, const void *, size_t);
+static int start_bfs_threads(void);
+static void stop_bfs_threads(int);
+static void *run_bfs_thread(void *);
+static void run_bfs_job(int, node_t *, path_t **, int, int);
+static void run_bfs_tasks(bfs_thread_t *);
+static void set_thread_distances(bfs_thread_t *, node_t *, path_t *);
+static int get_thread_distance(bfs_thread_t *, node_t *, path_t *, int, int *);
+static int add_thread_nodes(bfs_thread_t *, const path_t *, const edge_t *, node_t *, int *, int);
+static int get_thread_stamp(bfs_thread_t *);
 
-static int n_avenues, n_nodes, n_open_edges, n_initial_paths, n_paths, manhattan, low_bound, n_choices, n_q_nodes, min_q_paths, n_q_paths, low_q_paths, n_calls, n_bfs_paths, n_evaluations;
+static int n_avenues, n_nodes, n_open_edges, n_initial_paths, n_paths, manhattan, low_bound, n_choices, n_q_nodes, min_q_paths, n_q_paths, low_q_paths, n_calls, n_bfs_paths, n_evaluations, circuit_length;
 static edge_t *edges = NULL, *current_edge;
 static path_t **q_paths = NULL, **bfs_paths;
-static node_t *nodes = NULL, *current_node, **q_nodes = NULL;
+static node_t *nodes = NULL, *current_node, **q_nodes = NULL, **circuit = NULL, **repaired = NULL;
 static call_t *calls = NULL;
 static evaluation_t evaluations[MAX_EVALUATIONS];
+static int snapshot_calls, checkpoint_seconds;
+static FILE *stats_file;
+static stats_t stats;
+static const char *checkpoint_name, *resume_name, *delta_name, *warm_name;
+static int *delta_types = NULL, n_repaired, max_repaired;
+static char *checkpoint_tmp_name;
+static pid_t checkpoint_pid;
+static int n_workers;
+static volatile int *shared_best = NULL;
+static FILE *input;
+static int max_edges, max_nodes, max_q_nodes, max_q_paths, max_circuit, max_calls;
+static int n_batch_workers, n_batch_instances, n_batch_printed, max_batch_outputs, batch_end, batch_status;
+static char *batch_input = NULL, **batch_outputs = NULL;
+static size_t batch_size, batch_max;
+static int orient, n_oriented_arcs, max_oriented_arcs;
+static path_t *oriented_arcs;
+static int n_districts, district_seconds, *districts = NULL;
+static node_t **district_starts = NULL;
+static double search_deadline;
+static int n_detours, max_detours;
+static detour_t *detours = NULL;
+static int grid_offsets[N_DIRECTIONS];
+static int local_seconds;
+static int n_threads, bfs_job, bfs_generation, n_bfs_running, bfs_quit, n_bfs_tasks, bfs_distance, *bfs_results = NULL, *bfs_expanded = NULL;
+static node_t *bfs_start;
+static path_t **bfs_tasks, **bfs_candidates = NULL;
+static bfs_thread_t *bfs_threads = NULL;
+static pthread_mutex_t bfs_mutex;
+static pthread_cond_t bfs_start_cond, bfs_done_cond;
+
+int main(int argc, char *argv[]) {
+	int status, i;
+	const char *stats_name = NULL;
+	snapshot_calls = 0;
+	checkpoint_seconds = CHECKPOINT_SECONDS_DEFAULT;
+	checkpoint_name = NULL;
+	resume_name = NULL;
+	delta_name = NULL;
+	warm_name = NULL;
+	n_workers = 0;
+	n_batch_workers = 0;
+	n_threads = 1;
+	orient = 0;
+	n_districts = 0;
+	district_seconds = DISTRICT_SECONDS_DEFAULT;
+	search_deadline = 0;
+	local_seconds = 0;
+	for (i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-s") && i+1 < argc) {
+			stats_name = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-S") && i+1 < argc) {
+			if (!parse_int(argv[++i], 1, &snapshot_calls)) {
+				fputs("Invalid snapshot interval\n", stderr);
+				fflush(stderr);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "-c") && i+1 < argc) {
+			checkpoint_name = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-C") && i+1 < argc) {
+			if (!parse_int(argv[++i], 1, &checkpoint_seconds)) {
+				fputs("Invalid checkpoint interval\n", stderr);
+				fflush(stderr);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "-r") && i+1 < argc) {
+			resume_name = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-d") && i+1 < argc) {
+			delta_name = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-w") && i+1 < argc) {
+			warm_name = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-a") && i+1 < argc) {
+			if (!parse_int(argv[++i], 1, &n_workers)) {
+				fputs("Invalid number of workers\n", stderr);
+				fflush(stderr);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "-b") && i+1 < argc) {
+			if (!parse_int(argv[++i], 1, &n_batch_workers) || n_batch_workers > BATCH_WORKERS_MAX) {
+				fputs("Invalid number of batch workers\n", stderr);
+				fflush(stderr);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "-t") && i+1 < argc) {
+			if (!parse_int(argv[++i], 1, &n_threads)) {
+				fputs("Invalid number of threads\n", stderr);
+				fflush(stderr);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "-o")) {
+			orient = 1;
+		}
+		else if (!strcmp(argv[i], "-p") && i+1 < argc) {
+			if (!parse_int(argv[++i], 1, &n_districts) || n_districts > DISTRICTS_MAX) {
+				fputs("Invalid number of districts\n", stderr);
+				fflush(stderr);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "-P") && i+1 < argc) {
+			if (!parse_int(argv[++i], 1, &district_seconds)) {
+				fputs("Invalid district time budget\n", stderr);
+				fflush(stderr);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "-l") && i+1 < argc) {
+			if (!parse_int(argv[++i], 1, &local_seconds)) {
+				fputs("Invalid local search time budget\n", stderr);
+				fflush(stderr);
+				return EXIT_FAILURE;
+			}
+		}
+		else {
+			fputs("Usage: sweepnyc [-s stats_file] [-S snapshot_calls] [-c checkpoint_file] [-C checkpoint_seconds] [-r resume_file] [-d delta_file] [-w previous_output_file] [-a n_workers] [-b n_batch_workers] [-t n_threads] [-o] [-p n_districts] [-P district_seconds] [-l local_seconds]\n", stderr);
+			fflush(stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (snapshot_calls && !stats_name) {
+		fputs("Option -S requires -s\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (n_workers && (checkpoint_name || resume_name || warm_name)) {
+		fputs("Option -a cannot be combined with -c, -r or -w\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (n_batch_workers && (n_workers || checkpoint_name || resume_name || delta_name || warm_name || stats_name)) {
+		fputs("Option -b cannot be combined with -a, -c, -d, -r, -s or -w\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (n_threads > 1 && (n_workers || n_batch_workers)) {
+		fputs("Option -t cannot be combined with -a or -b\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (n_districts && (n_workers || n_batch_workers || checkpoint_name || resume_name || warm_name || n_threads > 1)) {
+		fputs("Option -p cannot be combined with -a, -b, -c, -r, -t or -w\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (checkpoint_name) {
+		checkpoint_tmp_name = malloc(strlen(checkpoint_name)+5);
+		if (!checkpoint_tmp_name) {
+			fputs("Cannot allocate memory for checkpoint file name\n", stderr);
+			fflush(stderr);
+			return EXIT_FAILURE;
+		}
+		strcpy(checkpoint_tmp_name, checkpoint_name);
+		strcat(checkpoint_tmp_name, ".tmp");
+	}
+	else {
+		checkpoint_tmp_name = NULL;
+	}
+	if (stats_name) {
+		stats_file = fopen(stats_name, "w");
+		if (!stats_file) {
+			fputs("Cannot open stats file\n", stderr);
+			fflush(stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	else {
+		stats_file = NULL;
+	}
+	if (n_batch_workers) {
+		status = solve_batch();
+	}
+	else {
+		input = stdin;
+		status = solve();
+	}
+	if (stats_file) {
+		write_stats_summary(status);
+		fclose(stats_file);
+	}
+	free_data();
+	if (checkpoint_tmp_name) {
+		free(checkpoint_tmp_name);
+	}
+	return status;
+}
+
+static int parse_int(const char *str, int min, int *value) {
+	char *end;
+	long value_read = strtol(str, &end, 10);
+	if (end == str || *end || value_read < min || value_read > 0x7fffffffL) {
+		return 0;
+	}
+	*value = (int)value_read;
+	return 1;
+}
 
-int main(void) {
+static int solve(void) {
 	int n_streets, start_street, start_avenue, n_edges, i;
+	double phase_start;
 	path_t path;
 	node_t *start;
-	if (scanf("%d", &n_streets) != 1 || n_streets < 1) {
+	memset(&stats, 0, sizeof(stats_t));
+	stats.start = get_time();
+	phase_start = stats.start;
+	if (fscanf(input, "%d", &n_streets) != 1 || n_streets < 1) {
 		fputs("Invalid number of streets\n", stderr);
 		fflush(stderr);
 		return EXIT_FAILURE;
 	}
-	if (scanf("%d", &n_avenues) != 1 || n_avenues < 1) {
+	if (fscanf(input, "%d", &n_avenues) != 1 || n_avenues < 1) {
 		fputs("Invalid number of avenues\n", stderr);
 		fflush(stderr);
 		return EXIT_FAILURE;
 	}
-	if (scanf("%d", &start_street) != 1 || start_street < 1 || start_street > n_streets) {
+	if (fscanf(input, "%d", &start_street) != 1 || start_street < 1 || start_street > n_streets) {
 		fputs("Invalid starting street\n", stderr);
 		fflush(stderr);
 		return EXIT_FAILURE;
 	}
-	if (scanf("%d", &start_avenue) != 1 || start_avenue < 1 || start_avenue > n_avenues) {
+	if (fscanf(input, "%d", &start_avenue) != 1 || start_avenue < 1 || start_avenue > n_avenues) {
 		fputs("Invalid starting avenue\n", stderr);
 		fflush(stderr);
 		return EXIT_FAILURE;
 	}
-	getchar();
+	getc(input);
 	n_edges = n_streets*(n_streets-1)+n_avenues*(n_avenues-1);
-	if (n_edges) {
-		edges = malloc(sizeof(edge_t)*(size_t)n_edges);
-		if (!edges) {
+	if (n_edges > max_edges) {
+		edge_t *edges_tmp = realloc(edges, sizeof(edge_t)*(size_t)n_edges);
+		if (!edges_tmp) {
 			fputs("Cannot allocate memory for edges\n", stderr);
 			fflush(stderr);
 			return EXIT_FAILURE;
 		}
+		edges = edges_tmp;
+		max_edges = n_edges;
 	}
-	n_nodes = n_streets*n_avenues;
-	nodes = malloc(sizeof(node_t)*(size_t)n_nodes);
-	if (!nodes) {
-		fputs("Cannot allocate memory for nodes\n", stderr);
-		fflush(stderr);
-		free_data();
+	if (delta_name && !read_delta(n_streets)) {
 		return EXIT_FAILURE;
 	}
+	n_nodes = n_streets*n_avenues;
+	if (n_nodes > max_nodes) {
+		node_t *nodes_tmp = realloc(nodes, sizeof(node_t)*(size_t)n_nodes);
+		if (!nodes_tmp) {
+			fputs("Cannot allocate memory for nodes\n", stderr);
+			fflush(stderr);
+			return EXIT_FAILURE;
+		}
+		nodes = nodes_tmp;
+
+		/* Paths arrays of the nodes are kept from one city to the next in batch mode */
+		for (i = max_nodes; i < n_nodes; ++i) {
+			nodes[i].max_to_paths = 0;
+			nodes[i].to_paths = NULL;
+			nodes[i].max_from_paths = 0;
+			nodes[i].from_paths = NULL;
+		}
+		max_nodes = n_nodes;
+	}
 	start = nodes+(start_street-1)*n_avenues+start_avenue-1;
+
+	/* North, west, east and south, the order in which read_node links the street arcs of a node */
+	grid_offsets[0] = -n_avenues;
+	grid_offsets[1] = -1;
+	grid_offsets[2] = 1;
+	grid_offsets[3] = n_avenues;
 	n_open_edges = 0;
 	n_initial_paths = 0;
 	n_paths = 0;
 	current_edge = edges;
 	current_node = nodes;
 	if (!read_street(1)) {
-		free_data();
 		return EXIT_FAILURE;
 	}
 	for (i = 2; i <= n_streets; ++i) {
 		if (!read_edges() || !read_street(i)) {
-			free_data();
 			return EXIT_FAILURE;
 		}
 	}
-	if (scanf("%d", &manhattan) != 1 || manhattan < 0 || manhattan > 1) {
+	if (fscanf(input, "%d", &manhattan) != 1 || manhattan < 0 || manhattan > 1) {
 		fputs("Invalid Manhattan flag\n", stderr);
 		fflush(stderr);
-		free_data();
 		return EXIT_FAILURE;
 	}
+	phase_start = set_phase(PHASE_PARSE, phase_start);
 	if (manhattan) {
 		low_bound = n_initial_paths;
 		printf("Number of initial paths %d\n", n_initial_paths);
@@ -188,23 +605,26 @@ int main(void) {
 		printf("Number of open edges %d\n", n_open_edges);
 	}
 	fflush(stdout);
-	q_nodes = malloc(sizeof(node_t *)*(size_t)n_nodes);
-	if (!q_nodes) {
-		fputs("Cannot allocate memory for queue nodes\n", stderr);
-		fflush(stderr);
-		free_data();
-		return EXIT_FAILURE;
+	if (n_nodes > max_q_nodes) {
+		node_t **q_nodes_tmp = realloc(q_nodes, sizeof(node_t *)*(size_t)n_nodes);
+		if (!q_nodes_tmp) {
+			fputs("Cannot allocate memory for queue nodes\n", stderr);
+			fflush(stderr);
+			return EXIT_FAILURE;
+		}
+		q_nodes = q_nodes_tmp;
+		max_q_nodes = n_nodes;
 	}
 	for (i = 0; i < n_nodes && nodes[i].polarity <= 0; ++i);
 	while (i < n_nodes) {
 		if (!reduce_polarity(nodes+i)) {
-			free_data();
 			return EXIT_FAILURE;
 		}
 		for (; i < n_nodes && nodes[i].polarity <= 0; ++i);
 	}
 	printf("Number of paths after polarity reducing %d\n", n_paths);
 	fflush(stdout);
+	phase_start = set_phase(PHASE_POLARITY, phase_start);
 	if (!manhattan) {
 		for (i = 0; i < n_nodes; ++i) {
 			set_reverse_paths(nodes+i);
@@ -212,52 +632,153 @@ int main(void) {
 	}
 	for (i = 0; i < n_nodes; ++i) {
 		if (!add_from_paths(nodes+i)) {
-			free_data();
 			return EXIT_FAILURE;
 		}
 	}
-	if (scanf("%d", &n_choices) != 1 || n_choices < 1 || n_choices > MAX_EVALUATIONS) {
+	if (fscanf(input, "%d", &n_choices) != 1 || n_choices < 1 || n_choices > MAX_EVALUATIONS) {
 		fputs("Invalid number of choices\n", stderr);
 		fflush(stderr);
-		free_data();
 		return EXIT_FAILURE;
 	}
-	min_q_paths = n_paths+1;
-	q_paths = malloc(sizeof(path_t *)*(size_t)(min_q_paths+n_paths));
-	if (!q_paths) {
-		fputs("Cannot allocate memory for q_paths\n", stderr);
-		fflush(stderr);
-		free_data();
+	if (!set_search_arrays()) {
 		return EXIT_FAILURE;
 	}
-	bfs_paths = q_paths+min_q_paths;
+	circuit_length = -1;
 	set_path(&path, NULL, NULL, start);
 	q_paths[0] = &path;
 	n_q_paths = 0;
-	calls = malloc(sizeof(call_t)*(size_t)(n_paths*6+1));
-	if (!calls) {
-		fputs("Cannot allocate memory for calls\n", stderr);
-		fflush(stderr);
-		free_data();
-		return EXIT_FAILURE;
-	}
 	low_q_paths = n_paths;
 	n_calls = 0;
-	add_call(0, start, &path);
-	while (n_calls) {
-		--n_calls;
-		process_call(calls+n_calls);
+	if (resume_name) {
+		if (!read_checkpoint(start, &path)) {
+			return EXIT_FAILURE;
+		}
+	}
+	else if (!n_workers && !n_districts) {
+		if (warm_name && !warm_start(start)) {
+			return EXIT_FAILURE;
+		}
+		if (orient && !manhattan && !orient_start(start)) {
+			return EXIT_FAILURE;
+		}
+		add_call(0, start, &path);
+	}
+	phase_start = set_phase(PHASE_SETUP, phase_start);
+	if (n_workers) {
+		if (!search_all_starts()) {
+			return EXIT_FAILURE;
+		}
+	}
+	else if (n_districts) {
+		if (!solve_districts(start)) {
+			return EXIT_FAILURE;
+		}
+	}
+	else {
+		if (n_threads > 1 && !start_bfs_threads()) {
+			return EXIT_FAILURE;
+		}
+		search(start);
+		if (n_threads > 1) {
+			stop_bfs_threads(n_threads);
+		}
+	}
+	set_phase(PHASE_SEARCH, phase_start);
+	if (checkpoint_name) {
+
+		/* The search is complete, the last checkpoint is not needed anymore */
+		if (checkpoint_pid > 0) {
+			waitpid(checkpoint_pid, NULL, 0);
+		}
+		remove(checkpoint_name);
 	}
-	if (min_q_paths > n_paths) {
+	if (circuit_length < 0) {
 		fputs("Cannot reach all paths\n", stderr);
 		fflush(stderr);
-		free_data();
 		return EXIT_FAILURE;
 	}
-	free_data();
+	if (local_seconds && !improve_circuit()) {
+		return EXIT_FAILURE;
+	}
 	return EXIT_SUCCESS;
 }
 
+/* Sizes the arrays of the search for the current number of paths, no circuit is known yet */
+
+static int set_search_arrays(void) {
+	min_q_paths = n_paths+1;
+	if (min_q_paths+n_paths > max_q_paths) {
+		path_t **q_paths_tmp = realloc(q_paths, sizeof(path_t *)*(size_t)(min_q_paths+n_paths));
+		if (!q_paths_tmp) {
+			fputs("Cannot allocate memory for q_paths\n", stderr);
+			fflush(stderr);
+			return 0;
+		}
+		q_paths = q_paths_tmp;
+		max_q_paths = min_q_paths+n_paths;
+	}
+	bfs_paths = q_paths+min_q_paths;
+	if (min_q_paths > max_circuit) {
+		node_t **circuit_tmp = realloc(circuit, sizeof(node_t *)*(size_t)min_q_paths);
+		if (!circuit_tmp) {
+			fputs("Cannot allocate memory for circuit\n", stderr);
+			fflush(stderr);
+			return 0;
+		}
+		circuit = circuit_tmp;
+		max_circuit = min_q_paths;
+	}
+	if (n_paths*6 >= max_calls) {
+		call_t *calls_tmp = realloc(calls, sizeof(call_t)*(size_t)(n_paths*6+1));
+		if (!calls_tmp) {
+			fputs("Cannot allocate memory for calls\n", stderr);
+			fflush(stderr);
+			return 0;
+		}
+		calls = calls_tmp;
+		max_calls = n_paths*6+1;
+	}
+	return 1;
+}
+
+/* Processes the calls until the stack is empty */
+
+static void search(node_t *start) {
+	int n_snapshot_calls = 0, n_checkpoint_calls = 0, n_shared_best_calls = 0;
+	double checkpoint_time = get_time()+checkpoint_seconds;
+	checkpoint_pid = 0;
+	while (n_calls) {
+		--n_calls;
+		process_call(calls+n_calls);
+		if (stats_file && snapshot_calls && ++n_snapshot_calls == snapshot_calls) {
+			write_stats_snapshot();
+			n_snapshot_calls = 0;
+		}
+		if (checkpoint_name && ++n_checkpoint_calls == CHECKPOINT_CHECK_CALLS) {
+			double now = get_time();
+			if (now >= checkpoint_time) {
+				checkpoint_search(start);
+				checkpoint_time = now+checkpoint_seconds;
+			}
+			n_checkpoint_calls = 0;
+		}
+		if (shared_best && ++n_shared_best_calls == SHARED_BEST_CHECK_CALLS) {
+
+			/* Another worker may have found a shorter circuit */
+			if (*shared_best <= min_q_paths) {
+				min_q_paths = *shared_best-1;
+			}
+			n_shared_best_calls = 0;
+		}
+
+		/* District worker, the best circuit found within the time budget is kept. The time is checked */
+		/* at each call as one call may run many BFSes once a circuit is found. */
+		if (search_deadline > 0 && get_time() >= search_deadline) {
+			break;
+		}
+	}
+}
+
 static int read_street(int street) {
 	const int edge_types[N_EDGE_TYPES] = { '-', '<', '>', 'o' };
 	int i;
@@ -269,12 +790,12 @@ static int read_street(int street) {
 			return 0;
 		}
 	}
-	getchar();
+	getc(input);
 	return 1;
 }
 
 static int read_node(int street, int avenue) {
-	if (getchar() != 'o') {
+	if (getc(input) != 'o') {
 		fputs("Invalid node\n", stderr);
 		fflush(stderr);
 		return 0;
@@ -283,9 +804,11 @@ static int read_node(int street, int avenue) {
 	current_node->avenue = avenue;
 	current_node->n_to_paths = 0;
 	current_node->polarity = 0;
+	current_node->arcs = 0;
 	current_node->n_from_paths = 0;
 	current_node->n_visits = 0;
 	current_node->visited = 0;
+	current_node->pending = NULL;
 	if (street > 1 && !link_node(current_edge-n_avenues, current_node-n_avenues, '|', '^', 'v')) {
 		return 0;
 	}
@@ -326,14 +849,17 @@ static int read_edges(void) {
 			return 0;
 		}
 	}
-	getchar();
+	getc(input);
 	return 1;
 }
 
 static int read_edge(const int *types, int n_types) {
-	int type_read = getchar(), i;
+	int type_read = getc(input), i;
 	for (i = 0; i < n_types && types[i] != type_read; ++i);
 	if (i < n_types) {
+		if (delta_types && delta_types[current_edge-edges]) {
+			type_read = delta_types[current_edge-edges];
+		}
 		if (type_read != 'o') {
 			++n_open_edges;
 		}
@@ -348,7 +874,7 @@ static int read_edge(const int *types, int n_types) {
 }
 
 static int read_separator(void) {
-	if (getchar() != ' ') {
+	if (getc(input) != ' ') {
 		fputs("Invalid separator\n", stderr);
 		fflush(stderr);
 		return 0;
@@ -368,6 +894,7 @@ static int reduce_polarity(node_t *positive) {
 	for (i = 0; i < n_q_nodes && q_nodes[i]->polarity >= 0; ++i) {
 		add_polarity_nodes(q_nodes[i]);
 	}
+	add_expansions(BFS_REDUCE_POLARITY, i);
 	reset_q_nodes();
 	if (i < n_q_nodes) {
 		node_t *node;
@@ -383,10 +910,14 @@ static int reduce_polarity(node_t *positive) {
 	return 0;
 }
 
+/* Virtual paths always double a street arc, the neighbours are found from the street arcs of the node */
+
 static void add_polarity_nodes(node_t *from) {
 	int i;
-	for (i = 0; i < from->n_to_paths; ++i) {
-		add_polarity_node(from, from->to_paths[i].to);
+	for (i = 0; i < N_DIRECTIONS; ++i) {
+		if (from->arcs & 1 << i) {
+			add_polarity_node(from, from+grid_offsets[i]);
+		}
 	}
 }
 
@@ -427,6 +958,7 @@ static int add_from_paths(node_t *from) {
 }
 
 static void process_call(call_t *call) {
+	++stats.calls[call->type];
 	dispatch_call(call->type, call->start, call->path);
 }
 
@@ -439,6 +971,7 @@ static void dispatch_call(int type, node_t *start, path_t *path) {
 			if (min_q_paths <= n_paths || !n_q_paths) {
 				init_q_nodes(from, 1, 0);
 				for (i = 0; i < n_q_nodes && !add_target_nodes(start, q_nodes[i], add_q_node1); ++i);
+				add_expansions(BFS_DISPATCH_CALL, i < n_q_nodes ? i+1:i);
 				reset_q_nodes();
 				if (i < n_q_nodes) {
 					distance1 = q_nodes[i]->distance;
@@ -449,6 +982,7 @@ static void dispatch_call(int type, node_t *start, path_t *path) {
 					for (i = 0; i < n_q_nodes && n_bfs_paths < low_bound; ++i) {
 						add_bfs_paths(q_nodes[i]);
 					}
+					add_expansions(BFS_DISPATCH_CALL, i);
 					for (i = n_bfs_paths; i--; ) {
 						reset_path(bfs_paths[i]);
 					}
@@ -457,8 +991,9 @@ static void dispatch_call(int type, node_t *start, path_t *path) {
 						distance2 = 0;
 						if (min_q_paths <= n_paths) {
 							int to_start = 0;
+							set_bfs_distances(start);
 							for (i = n_bfs_paths; i--; ) {
-								distance2 += get_distance_next(start, bfs_paths[i]);
+								distance2 += merge_distance_next(bfs_paths[i]);
 								if (!to_start) {
 									to_start = bfs_paths[i]->to_start;
 								}
@@ -503,31 +1038,16 @@ static void dispatch_call(int type, node_t *start, path_t *path) {
 					}
 				}
 			}
-		}
-		else {
-			for (i = 0; i < n_q_paths; ++i) {
-				link_paths(q_paths[i], q_paths[i+1]);
-			}
-			link_paths(q_paths[i], q_paths[0]);
-			for (path = q_paths[0]->last; path != q_paths[0]; path = path->last) {
-				path_t *old_last = path->last;
-				if (path->from != old_last->to) {
-					path_t *new_last;
-					for (new_last = old_last->last; new_last != q_paths[0] && new_last->to != path->from; new_last = new_last->last);
-					link_paths(q_paths[0]->last, new_last->next);
-					link_paths(new_last, path);
-					link_paths(old_last, q_paths[0]);
-					path = q_paths[0];
-				}
+			else if (n_q_paths+low_bound+distance1 < min_q_paths) {
+				++stats.prunes[PRUNE_DISTANCE2];
 			}
-			fputs("Circuit", stdout);
-			print_node(q_paths[0]->to);
-			for (path = q_paths[0]->next; path != q_paths[0]; path = path->next) {
-				print_node(path->to);
+			else {
+				++stats.prunes[PRUNE_DISTANCE1];
 			}
-			printf("\nLength %d\n", n_q_paths);
-			fflush(stdout);
-			min_q_paths = n_q_paths-1;
+		}
+		else {
+			set_circuit(q_paths[0]->to);
+			set_incumbent(circuit, n_q_paths);
 		}
 	}
 	else if (type == 1) {
@@ -549,8 +1069,10 @@ static void dispatch_call(int type, node_t *start, path_t *path) {
 		--path->from->n_visits;
 		if (n_q_paths < low_q_paths) {
 			low_q_paths = n_q_paths;
-			printf("low_q_paths %d\n", low_q_paths);
-			fflush(stdout);
+			if (!shared_best) {
+				printf("low_q_paths %d\n", low_q_paths);
+				fflush(stdout);
+			}
 		}
 	}
 }
@@ -580,10 +1102,25 @@ static void add_q_node2(node_t *to) {
 	}
 }
 
-static int get_distance_next(node_t *start, path_t *path) {
-	set_distances(start, path);
+/* Computes the distances of each path found by the BFS and of its reverse, */
+/* the BFSes are independent and are shared between threads if there are several */
+
+static void set_bfs_distances(node_t *start) {
+	int i;
+	if (n_threads > 1 && n_bfs_paths > 1 && n_bfs_paths*n_nodes >= BFS_THREADS_WORK_MIN) {
+		run_bfs_job(BFS_SET_DISTANCES, start, bfs_paths, n_bfs_paths, 0);
+		return;
+	}
+	for (i = n_bfs_paths; i--; ) {
+		set_distances(start, bfs_paths[i]);
+		if (bfs_paths[i]->reverse) {
+			set_distances(start, bfs_paths[i]->reverse);
+		}
+	}
+}
+
+static int merge_distance_next(path_t *path) {
 	if (path->reverse) {
-		set_distances(start, path->reverse);
 		if (path->reverse->distance_start != -1) {
 			if (path->reverse->distance_next < path->distance_next) {
 				path->distance_next = path->reverse->distance_next;
@@ -597,7 +1134,7 @@ static int get_distance_next(node_t *start, path_t *path) {
 }
 
 static void set_distances(node_t *start, path_t *path) {
-	int i;
+	int i, j;
 	node_t *to = path->to;
 	path->edge->visited = 1;
 	path->visited = 1;
@@ -607,11 +1144,13 @@ static void set_distances(node_t *start, path_t *path) {
 	if (i < n_q_nodes) {
 		path->distance_next = q_nodes[i]->distance;
 		path->to_start = 0;
-		for (; i < n_q_nodes && start->distance == -1; ++i) {
-			add_distance_nodes2(q_nodes[i]);
+		for (j = i; j < n_q_nodes && start->distance == -1; ++j) {
+			add_distance_nodes2(q_nodes[j]);
 		}
+		add_expansions(BFS_SET_DISTANCES, j);
 	}
 	else {
+		add_expansions(BFS_SET_DISTANCES, i);
 		path->distance_next = start->distance;
 		path->to_start = 1;
 	}
@@ -649,6 +1188,23 @@ static void add_distance_node2(node_t *from, path_t *path) {
 	}
 }
 
+/* Same as add_distance_nodes2 when no path is visited */
+
+static void add_distance_nodes3(node_t *from) {
+	int i;
+	for (i = 0; i < N_DIRECTIONS; ++i) {
+		if (from->arcs & 1 << i) {
+			add_q_node1(from, from+grid_offsets[i]);
+		}
+	}
+}
+
+static int get_arc(const node_t *from, const node_t *to) {
+	int i;
+	for (i = 0; i < N_DIRECTIONS && to-from != grid_offsets[i]; ++i);
+	return 1 << i;
+}
+
 static int get_delta(path_t *path) {
 	if (path->reverse && path->reverse->distance_start != -1 && path->reverse->distance_start < path->distance_start) {
 		return path->reverse->distance_start-path->distance_next;
@@ -671,10 +1227,18 @@ static void add_node_calls(node_t *start, node_t *from, int distance) {
 		add_path_calls1(from->to_paths+i);
 	}
 	if (n_q_paths+low_bound+distance < min_q_paths) {
-		for (i = from->n_to_paths; i--; ) {
-			add_path_calls2(start, from->to_paths+i, distance);
+		if (n_threads > 1 && from->n_to_paths*n_nodes >= BFS_THREADS_WORK_MIN) {
+			add_paths_calls2(start, from, distance);
+		}
+		else {
+			for (i = from->n_to_paths; i--; ) {
+				add_path_calls2(start, from->to_paths+i, distance);
+			}
 		}
 	}
+	else {
+		++stats.prunes[PRUNE_BRANCH];
+	}
 	if (n_evaluations) {
 		for (i = from->n_to_paths; i--; ) {
 			reset_node(from->to_paths[i].to);
@@ -710,6 +1274,7 @@ static void add_path_calls2(node_t *start, path_t *evaluated, int distance) {
 			evaluated->visited = 1;
 			init_q_nodes(to, 2, distance);
 			for (i = 0; i < n_q_nodes && !add_target_nodes(start, q_nodes[i], add_q_node3); ++i);
+			add_expansions(BFS_ADD_PATH_CALLS2, i < n_q_nodes ? i+1:i);
 			for (j = n_q_nodes; j--; ) {
 				q_nodes[j]->visited ^= 2;
 			}
@@ -726,6 +1291,37 @@ static void add_path_calls2(node_t *start, path_t *evaluated, int distance) {
 	}
 }
 
+/* Same as add_path_calls2 for all paths of a node, the BFSes of the candidates are shared between threads */
+/* then the evaluations are added in the same order */
+
+static void add_paths_calls2(node_t *start, node_t *from, int distance) {
+	int n_candidates = 0, i;
+	for (i = from->n_to_paths; i--; ) {
+		path_t *evaluated = from->to_paths+i;
+		if (!check_edge(evaluated->edge) && !evaluated->visited && !evaluated->to->visited) {
+			bfs_candidates[n_candidates++] = evaluated;
+		}
+	}
+	if (n_candidates < 2) {
+		for (i = 0; i < n_candidates; ++i) {
+			add_path_calls2(start, bfs_candidates[i], distance);
+		}
+		return;
+	}
+	run_bfs_job(BFS_ADD_PATH_CALLS2, start, bfs_candidates, n_candidates, distance);
+
+	/* As in add_path_calls2, a candidate whose target an earlier candidate reached is neither evaluated nor counted */
+	for (i = 0; i < n_candidates; ++i) {
+		node_t *to = bfs_candidates[i]->to;
+		if (!to->visited) {
+			add_expansions(BFS_ADD_PATH_CALLS2, bfs_expanded[i]);
+			if (bfs_results[i] >= 0) {
+				check_distance(bfs_candidates[i], to, bfs_results[i]);
+			}
+		}
+	}
+}
+
 static void add_q_node3(node_t *from, node_t *to) {
 	if (!(to->visited & 2)) {
 		to->visited |= 2;
@@ -738,6 +1334,9 @@ static void check_distance(path_t *path, node_t *to, int distance) {
 	if (n_q_paths+low_bound+distance < min_q_paths) {
 		add_evaluation(to, path, distance, to->n_visits*2);
 	}
+	else {
+		++stats.prunes[PRUNE_CANDIDATE];
+	}
 }
 
 static int add_target_nodes(node_t *start, node_t *from, void (*add_q_node)(node_t *, node_t *)) {
@@ -764,30 +1363,23 @@ static int check_edge(edge_t *edge) {
 }
 
 static int add_to_path(node_t *from, edge_t *edge, node_t *to) {
-	if (from->n_to_paths) {
-		path_t *paths_tmp = realloc(from->to_paths, sizeof(path_t)*(size_t)(from->n_to_paths+1));
+	if (from->n_to_paths == from->max_to_paths) {
+		int max_to_paths = from->max_to_paths ? from->max_to_paths*2:N_PATHS_MIN;
+		path_t *paths_tmp = realloc(from->to_paths, sizeof(path_t)*(size_t)max_to_paths);
 		if (!paths_tmp) {
 			fputs("Cannot reallocate memory for paths\n", stderr);
 			fflush(stderr);
-			from->n_to_paths = 0;
-			free(from->to_paths);
 			return 0;
 		}
 		from->to_paths = paths_tmp;
-	}
-	else {
-		from->to_paths = malloc(sizeof(path_t));
-		if (!from->to_paths) {
-			fputs("Cannot allocate memory for paths\n", stderr);
-			fflush(stderr);
-			return 0;
-		}
+		from->max_to_paths = max_to_paths;
 	}
 	set_path(from->to_paths+from->n_to_paths, from, edge, to);
 	++from->n_to_paths;
 	--from->polarity;
 	++to->polarity;
 	if (edge) {
+		from->arcs |= get_arc(from, to);
 		++n_initial_paths;
 	}
 	++n_paths;
@@ -796,24 +1388,16 @@ static int add_to_path(node_t *from, edge_t *edge, node_t *to) {
 
 static int add_from_path(path_t *path) {
 	node_t *to = path->to;
-	if (to->n_from_paths) {
-		path_t **paths_tmp = realloc(to->from_paths, sizeof(path_t *)*(size_t)(to->n_from_paths+1));
+	if (to->n_from_paths == to->max_from_paths) {
+		int max_from_paths = to->max_from_paths ? to->max_from_paths*2:N_PATHS_MIN;
+		path_t **paths_tmp = realloc(to->from_paths, sizeof(path_t *)*(size_t)max_from_paths);
 		if (!paths_tmp) {
 			fputs("Cannot reallocate memory for paths\n", stderr);
 			fflush(stderr);
-			to->n_from_paths = 0;
-			free(to->from_paths);
 			return 0;
 		}
 		to->from_paths = paths_tmp;
-	}
-	else {
-		to->from_paths = malloc(sizeof(path_t *));
-		if (!to->from_paths) {
-			fputs("Cannot allocate memory for paths\n", stderr);
-			fflush(stderr);
-			return 0;
-		}
+		to->max_from_paths = max_from_paths;
 	}
 	to->from_paths[to->n_from_paths++] = path;
 	return 1;
@@ -832,11 +1416,6 @@ static void reset_path(path_t *path) {
 	path->edge->visited = 0;
 }
 
-static void link_paths(path_t *path_a, path_t *path_b) {
-	path_a->next = path_b;
-	path_b->last = path_a;
-}
-
 static void init_q_nodes(node_t *node, int visited, int distance) {
 	node->visited = visited;
 	node->distance = distance;
@@ -907,30 +1486,2501 @@ static int compare_evaluations(const void *a, const void *b) {
 static void free_data(void) {
 	if (calls) {
 		free(calls);
+		calls = NULL;
+	}
+	if (circuit) {
+		free(circuit);
+		circuit = NULL;
+	}
+	if (repaired) {
+		free(repaired);
+		repaired = NULL;
+	}
+	if (detours) {
+		free(detours);
+		detours = NULL;
+	}
+	if (delta_types) {
+		free(delta_types);
+		delta_types = NULL;
+	}
+	if (districts) {
+		free(districts);
+		districts = NULL;
+	}
+	if (district_starts) {
+		free(district_starts);
+		district_starts = NULL;
 	}
 	if (q_paths) {
 		free(q_paths);
+		q_paths = NULL;
 	}
 	if (q_nodes) {
 		free(q_nodes);
+		q_nodes = NULL;
 	}
 	if (nodes) {
 		int i;
-		for (i = n_nodes; i--; ) {
+		for (i = max_nodes; i--; ) {
 			free_node(nodes+i);
 		}
 		free(nodes);
+		nodes = NULL;
 	}
 	if (edges) {
 		free(edges);
-	}
+		edges = NULL;
+	}
+	max_edges = 0;
+	max_nodes = 0;
+	max_q_nodes = 0;
+	max_q_paths = 0;
+	max_circuit = 0;
+	max_calls = 0;
+	max_repaired = 0;
+	max_detours = 0;
 }
 
 static void free_node(node_t *node) {
-	if (node->n_from_paths) {
+	if (node->from_paths) {
 		free(node->from_paths);
 	}
-	if (node->n_to_paths) {
+	if (node->to_paths) {
 		free(node->to_paths);
 	}
 }
+
+static double get_time(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec+(double)now.tv_nsec/1000000000.0;
+}
+
+static double set_phase(int phase, double phase_start) {
+	double now = get_time();
+	stats.phases[phase] = now-phase_start;
+	return now;
+}
+
+static void add_expansions(int caller, int n_expanded) {
+	stats.bfs_expansions[caller] += (unsigned long)n_expanded;
+}
+
+static void write_stats_snapshot(void) {
+	fputs("{\"snapshot\":{\"elapsed\":", stats_file);
+	write_stats_seconds(get_time()-stats.start);
+	fprintf(stats_file, ",\"n_q_paths\":%d,\"low_q_paths\":%d,", n_q_paths, low_q_paths);
+	write_stats_counters();
+	fputs("}}\n", stats_file);
+	fflush(stats_file);
+}
+
+static void write_stats_summary(int status) {
+	const char *phase_names[N_PHASES] = { "parse", "polarity", "setup", "search" };
+	int i;
+	fprintf(stats_file, "{\"summary\":{\"status\":\"%s\",\"elapsed\":", status == EXIT_SUCCESS ? "ok":"error");
+	write_stats_seconds(get_time()-stats.start);
+	fputs(",\"phases\":{", stats_file);
+	for (i = 0; i < N_PHASES; ++i) {
+		fprintf(stats_file, "%s\"%s\":", i ? ",":"", phase_names[i]);
+		write_stats_seconds(stats.phases[i]);
+	}
+	fprintf(stats_file, "},\"n_paths\":%d,", n_paths);
+	write_stats_counters();
+	fputs("}}\n", stats_file);
+	fflush(stats_file);
+}
+
+static void write_stats_counters(void) {
+	fprintf(stats_file, "\"circuits\":{\"found\":%d", stats.n_circuits);
+	if (stats.n_circuits && circuit_length >= 0) {
+		fprintf(stats_file, ",\"best_length\":%d,\"first\":", circuit_length);
+		write_stats_seconds(stats.first_circuit);
+		fputs(",\"best\":", stats_file);
+		write_stats_seconds(stats.best_circuit);
+	}
+	fprintf(stats_file, "},\"calls\":{\"type0\":%lu,\"type1\":%lu,\"type2\":%lu}", stats.calls[0], stats.calls[1], stats.calls[2]);
+	fprintf(stats_file, ",\"prunes\":{\"distance1\":%lu,\"distance2\":%lu,\"branch\":%lu,\"candidate\":%lu}", stats.prunes[PRUNE_DISTANCE1], stats.prunes[PRUNE_DISTANCE2], stats.prunes[PRUNE_BRANCH], stats.prunes[PRUNE_CANDIDATE]);
+	fprintf(stats_file, ",\"bfs_expansions\":{\"dispatch_call\":%lu,\"set_distances\":%lu,\"add_path_calls2\":%lu,\"reduce_polarity\":%lu}", stats.bfs_expansions[BFS_DISPATCH_CALL], stats.bfs_expansions[BFS_SET_DISTANCES], stats.bfs_expansions[BFS_ADD_PATH_CALLS2], stats.bfs_expansions[BFS_REDUCE_POLARITY]);
+}
+
+static void write_stats_seconds(double seconds) {
+	fprintf(stats_file, "%.6f", seconds);
+}
+
+/* Hierholzer algorithm on the paths of the search, each node keeps the list of its pending paths. */
+/* The stack of nodes grows from the beginning of the circuit array while the circuit is completed */
+/* from its end, they never overlap as each path walked is either on the stack or in the circuit */
+
+static void set_circuit(node_t *start) {
+	int i;
+	for (i = n_q_paths; i > 0; --i) {
+		add_pending_path(q_paths[i]);
+	}
+	walk_pending_paths(circuit, start, n_q_paths);
+}
+
+/* Returns 0 if some pending paths could not be reached from the start node */
+
+static int walk_pending_paths(node_t **walked, node_t *start, int length) {
+	int n_stack = 1, n_walked = length+1;
+	walked[0] = start;
+	while (n_stack) {
+		node_t *node = walked[n_stack-1];
+		if (node->pending) {
+			walked[n_stack++] = node->pending->to;
+			node->pending = node->pending->next_pending;
+		}
+		else {
+			walked[--n_walked] = node;
+			--n_stack;
+		}
+	}
+	return !n_walked;
+}
+
+static void add_pending_path(path_t *path) {
+	path->next_pending = path->from->pending;
+	path->from->pending = path;
+}
+
+static void print_circuit(void) {
+	int i;
+	fputs("Circuit", stdout);
+	for (i = 0; i <= circuit_length; ++i) {
+		print_node(circuit[i]);
+	}
+	printf("\nLength %d\n", circuit_length);
+	fflush(stdout);
+}
+
+/* The checkpoint is written by a child process working on a copy of the search state, */
+/* a new checkpoint is skipped while the previous one is still being written */
+
+static void checkpoint_search(const node_t *start) {
+	if (checkpoint_pid > 0) {
+		if (!waitpid(checkpoint_pid, NULL, WNOHANG)) {
+			return;
+		}
+		checkpoint_pid = 0;
+	}
+	checkpoint_pid = fork();
+	if (!checkpoint_pid) {
+		_exit(write_checkpoint(start) ? EXIT_SUCCESS:EXIT_FAILURE);
+	}
+	if (checkpoint_pid < 0) {
+		checkpoint_pid = 0;
+		write_checkpoint(start);
+	}
+}
+
+/* The file is written under a temporary name then renamed, so that a complete checkpoint is always available */
+
+static int write_checkpoint(const node_t *start) {
+	int i, j;
+	FILE *checkpoint = fopen(checkpoint_tmp_name, "w");
+	if (!checkpoint) {
+		fputs("Cannot open checkpoint file\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	fprintf(checkpoint, "%s %d\n", CHECKPOINT_MAGIC, CHECKPOINT_VERSION);
+	fprintf(checkpoint, "%d %d %d %d %d %d %lu\n", n_nodes, n_avenues, (int)(start-nodes), manhattan, n_choices, n_paths, get_city_checksum());
+	fprintf(checkpoint, "%d %d %d %d %d\n", low_bound, n_q_paths, min_q_paths, low_q_paths, n_calls);
+	for (i = 0; i < n_calls; ++i) {
+		fprintf(checkpoint, "%d %d", calls[i].type, calls[i].start ? (int)(calls[i].start-nodes):-1);
+		write_checkpoint_path(checkpoint, calls[i].path);
+	}
+	for (i = 1; i <= n_q_paths; ++i) {
+		write_checkpoint_path(checkpoint, q_paths[i]);
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		fprintf(checkpoint, "%d", nodes[i].n_visits);
+		for (j = 0; j < nodes[i].n_to_paths; ++j) {
+			fprintf(checkpoint, " %d", nodes[i].to_paths[j].visited);
+		}
+		fputs("\n", checkpoint);
+	}
+	for (i = 0; i < current_edge-edges; ++i) {
+		fprintf(checkpoint, "%d\n", edges[i].visited);
+	}
+	fprintf(checkpoint, "%d\n", circuit_length);
+	for (i = 0; i <= circuit_length; ++i) {
+		fprintf(checkpoint, "%d\n", (int)(circuit[i]-nodes));
+	}
+	if (ferror(checkpoint)) {
+		fputs("Cannot write checkpoint file\n", stderr);
+		fflush(stderr);
+		fclose(checkpoint);
+		return 0;
+	}
+	fclose(checkpoint);
+	if (rename(checkpoint_tmp_name, checkpoint_name)) {
+		fputs("Cannot rename checkpoint file\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	return 1;
+}
+
+/* A path is identified by the index of its origin node and its index in the paths of that node, */
+/* the root path of the search has no origin */
+
+static void write_checkpoint_path(FILE *checkpoint, const path_t *path) {
+	if (path->from) {
+		fprintf(checkpoint, " %d %d\n", (int)(path->from-nodes), (int)(path-path->from->to_paths));
+	}
+	else {
+		fputs(" -1 -1\n", checkpoint);
+	}
+}
+
+static int read_checkpoint(const node_t *start, path_t *root) {
+	int r;
+	FILE *checkpoint = fopen(resume_name, "r");
+	if (!checkpoint) {
+		fputs("Cannot open resume file\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	r = read_checkpoint_state(checkpoint, start, root);
+	fclose(checkpoint);
+	if (!r) {
+		fputs("Invalid resume file\n", stderr);
+		fflush(stderr);
+	}
+	return r;
+}
+
+static int read_checkpoint_state(FILE *checkpoint, const node_t *start, path_t *root) {
+	char magic[sizeof(CHECKPOINT_MAGIC)];
+	int version, city[6], i, j;
+	unsigned long checksum;
+	if (fscanf(checkpoint, "%19s%d", magic, &version) != 2 || strcmp(magic, CHECKPOINT_MAGIC) || version != CHECKPOINT_VERSION) {
+		return 0;
+	}
+	for (i = 0; i < 6 && read_checkpoint_int(checkpoint, -1, 0x7fffffff, city+i); ++i);
+	if (i < 6 || fscanf(checkpoint, "%lu", &checksum) != 1) {
+		return 0;
+	}
+	if (city[0] != n_nodes || city[1] != n_avenues || city[2] != (int)(start-nodes) || city[3] != manhattan || city[4] != n_choices || city[5] != n_paths || checksum != get_city_checksum()) {
+		fputs("Resume file does not match the city\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	if (!read_checkpoint_int(checkpoint, 0, n_paths+1, &low_bound) || !read_checkpoint_int(checkpoint, 0, n_paths+1, &n_q_paths) || !read_checkpoint_int(checkpoint, 0, n_paths+2, &min_q_paths) || !read_checkpoint_int(checkpoint, 0, n_paths+1, &low_q_paths) || !read_checkpoint_int(checkpoint, 0, n_paths*6+2, &n_calls)) {
+		return 0;
+	}
+	for (i = 0; i < n_calls; ++i) {
+		int type, call_start;
+		path_t *path;
+		if (!read_checkpoint_int(checkpoint, 0, N_CALL_TYPES, &type) || !read_checkpoint_int(checkpoint, -1, n_nodes, &call_start) || !read_checkpoint_path(checkpoint, root, &path)) {
+			return 0;
+		}
+		set_call(calls+i, type, call_start >= 0 ? nodes+call_start:NULL, path);
+	}
+	for (i = 1; i <= n_q_paths; ++i) {
+		if (!read_checkpoint_path(checkpoint, root, q_paths+i)) {
+			return 0;
+		}
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		if (!read_checkpoint_int(checkpoint, 0, n_paths+1, &nodes[i].n_visits)) {
+			return 0;
+		}
+		for (j = 0; j < nodes[i].n_to_paths; ++j) {
+			if (!read_checkpoint_int(checkpoint, 0, 2, &nodes[i].to_paths[j].visited)) {
+				return 0;
+			}
+		}
+	}
+	for (i = 0; i < current_edge-edges; ++i) {
+		if (!read_checkpoint_int(checkpoint, 0, n_paths+1, &edges[i].visited)) {
+			return 0;
+		}
+	}
+	if (!read_checkpoint_int(checkpoint, -1, n_paths+1, &circuit_length) || (circuit_length >= 0 && circuit_length != min_q_paths+1)) {
+		return 0;
+	}
+	for (i = 0; i <= circuit_length; ++i) {
+		int node;
+		if (!read_checkpoint_int(checkpoint, 0, n_nodes, &node)) {
+			return 0;
+		}
+		circuit[i] = nodes+node;
+	}
+	if (circuit_length >= 0) {
+		print_circuit();
+	}
+	return 1;
+}
+
+/* Reads an integer in the range [min, limit[ */
+
+static int read_checkpoint_int(FILE *checkpoint, int min, int limit, int *value) {
+	return fscanf(checkpoint, "%d", value) == 1 && *value >= min && *value < limit;
+}
+
+static int read_checkpoint_path(FILE *checkpoint, path_t *root, path_t **path) {
+	int node, index;
+	if (!read_checkpoint_int(checkpoint, -1, n_nodes, &node)) {
+		return 0;
+	}
+	if (node < 0) {
+		*path = root;
+		return read_checkpoint_int(checkpoint, -1, 0, &index);
+	}
+	if (!read_checkpoint_int(checkpoint, 0, nodes[node].n_to_paths, &index)) {
+		return 0;
+	}
+	*path = nodes[node].to_paths+index;
+	return 1;
+}
+
+/* Identifies the city and its augmented paths, so that a checkpoint is not resumed on another city */
+
+static unsigned long get_city_checksum(void) {
+	int i;
+	unsigned long checksum = 0;
+	for (i = 0; i < current_edge-edges; ++i) {
+		checksum = (checksum*31+(unsigned long)edges[i].type) & 0xffffffffUL;
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		checksum = (checksum*31+(unsigned long)nodes[i].n_to_paths) & 0xffffffffUL;
+	}
+	return checksum;
+}
+
+/* Reads the list of edge changes applied to the city, one per line: both ends of the edge then its new type, */
+/* for example "S2/A3 S2/A4 >" */
+
+static int read_delta(int n_streets) {
+	int street_a, avenue_a, street_b, avenue_b, r;
+	char type;
+	FILE *delta = fopen(delta_name, "r");
+	if (!delta) {
+		fputs("Cannot open delta file\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	delta_types = calloc((size_t)(n_streets*(n_streets-1)+n_avenues*(n_avenues-1)+1), sizeof(int));
+	if (!delta_types) {
+		fputs("Cannot allocate memory for delta\n", stderr);
+		fflush(stderr);
+		fclose(delta);
+		return 0;
+	}
+	while ((r = fscanf(delta, " S%d/A%d S%d/A%d %c", &street_a, &avenue_a, &street_b, &avenue_b, &type)) == 5 && read_delta_edge(n_streets, street_a, avenue_a, street_b, avenue_b, type));
+	fclose(delta);
+	if (r != EOF) {
+		fputs("Invalid delta\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	return 1;
+}
+
+static int read_delta_edge(int n_streets, int street_a, int avenue_a, int street_b, int avenue_b, int type) {
+	int street = street_a < street_b ? street_a:street_b, avenue = avenue_a < avenue_b ? avenue_a:avenue_b;
+	if (street < 1 || avenue < 1 || (street_a > street_b ? street_a:street_b) > n_streets || (avenue_a > avenue_b ? avenue_a:avenue_b) > n_avenues) {
+		return 0;
+	}
+	if (street_a == street_b && (avenue_a-avenue_b == 1 || avenue_b-avenue_a == 1)) {
+		if (type != '-' && type != '<' && type != '>' && type != 'o') {
+			return 0;
+		}
+		delta_types[(street-1)*(n_avenues*2-1)+avenue-1] = type;
+		return 1;
+	}
+	if (avenue_a == avenue_b && (street_a-street_b == 1 || street_b-street_a == 1)) {
+		if (type != '|' && type != '^' && type != 'v' && type != 'o') {
+			return 0;
+		}
+		delta_types[(street-1)*(n_avenues*2-1)+n_avenues-1+avenue-1] = type;
+		return 1;
+	}
+	return 0;
+}
+
+/* Uses the last circuit printed in a previous output as the initial incumbent of the search, */
+/* once repaired to fit the city changes. The search then only looks for shorter circuits. */
+
+static int warm_start(node_t *start) {
+	int r;
+	FILE *previous = fopen(warm_name, "r");
+	if (!previous) {
+		fputs("Cannot open previous output file\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	r = read_previous_circuit(previous);
+	fclose(previous);
+	if (!r) {
+		return 0;
+	}
+	if (!repair_circuit(start)) {
+		fputs("Cannot repair previous circuit\n", stderr);
+		fflush(stderr);
+		return 1;
+	}
+	if (n_repaired-1 > n_paths) {
+		fputs("Repaired circuit too long to be used\n", stderr);
+		fflush(stderr);
+		return 1;
+	}
+	set_incumbent(repaired, n_repaired-1);
+	return 1;
+}
+
+static int read_previous_circuit(FILE *previous) {
+	char token[32];
+	int in_circuit = 0, n_circuit = 0;
+	n_repaired = 0;
+	while (fscanf(previous, "%31s", token) == 1) {
+		if (!strcmp(token, "Circuit")) {
+			n_repaired = 0;
+			in_circuit = 1;
+		}
+		else if (!strcmp(token, "Length")) {
+			in_circuit = 0;
+			n_circuit = n_repaired;
+		}
+		else if (in_circuit) {
+			int street, avenue;
+			char end;
+			if (sscanf(token, "S%d/A%d%c", &street, &avenue, &end) != 2 || street < 1 || street > n_nodes/n_avenues || avenue < 1 || avenue > n_avenues) {
+				fputs("Invalid previous circuit\n", stderr);
+				fflush(stderr);
+				return 0;
+			}
+			if (!add_repaired_node(nodes+(street-1)*n_avenues+avenue-1)) {
+				return 0;
+			}
+		}
+	}
+	if (!n_circuit) {
+		fputs("No previous circuit found\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	n_repaired = n_circuit;
+	return 1;
+}
+
+/* The previous circuit is walked from the start node, each step that is not legal anymore is replaced */
+/* by a shortest path. Then each required path still not covered gets a detour from the first walk of its origin. */
+/* Visited flags of paths (arcs) or edges mark what is covered, they are reset before the search. */
+
+static int repair_circuit(node_t *start) {
+	int n_previous = n_repaired, r = 1, *hosts, i, j;
+	node_t **previous = malloc(sizeof(node_t *)*(size_t)n_previous);
+	if (!previous) {
+		fputs("Cannot allocate memory for previous circuit\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	memcpy(previous, repaired, sizeof(node_t *)*(size_t)n_previous);
+	n_repaired = 0;
+	add_repaired_node(start);
+	for (i = 0; i < n_previous && r; ++i) {
+		r = add_shortest_path(repaired[n_repaired-1], previous[i]);
+	}
+	free(previous);
+	if (r) {
+		r = add_shortest_path(repaired[n_repaired-1], start);
+	}
+	hosts = r ? malloc(sizeof(int)*(size_t)n_nodes):NULL;
+	if (r && !hosts) {
+		fputs("Cannot allocate memory for detour hosts\n", stderr);
+		fflush(stderr);
+		r = 0;
+	}
+	if (r) {
+		int n_walked = n_repaired;
+		for (i = 0; i < n_nodes; ++i) {
+			hosts[i] = -1;
+		}
+		for (i = n_walked; i--; ) {
+			hosts[repaired[i]-nodes] = i;
+		}
+		for (i = 1; i < n_walked; ++i) {
+			set_covered(repaired[i-1], repaired[i], 1);
+		}
+		n_detours = 0;
+		for (i = 0; i < n_nodes && r; ++i) {
+			for (j = 0; j < nodes[i].n_to_paths && r; ++j) {
+				r = cover_path(nodes[i].to_paths+j, hosts, n_walked);
+			}
+		}
+		if (r && n_detours) {
+			r = splice_detours(n_walked);
+		}
+	}
+	free(hosts);
+	for (i = 0; i < n_nodes; ++i) {
+		for (j = 0; j < nodes[i].n_to_paths; ++j) {
+			nodes[i].to_paths[j].visited = 0;
+		}
+	}
+	for (i = 0; i < current_edge-edges; ++i) {
+		edges[i].visited = 0;
+	}
+	return r;
+}
+
+/* The detour is appended after the walked circuit and hosted by the first walk of the origin, */
+/* in the circuit or in a previous detour, or by the end of the circuit if the origin is not walked */
+
+static int cover_path(path_t *path, int *hosts, int n_walked) {
+	int host = hosts[path->from-nodes], first = n_repaired, i;
+	if (!path->edge || path->visited || (!manhattan && path->edge->visited)) {
+		return 1;
+	}
+	if (host < 0) {
+		host = n_walked-1;
+	}
+	if (!add_shortest_path(repaired[host], path->from) || !add_repaired_node(path->to) || !add_shortest_path(path->to, repaired[host]) || !add_detour(host, first)) {
+		return 0;
+	}
+	set_covered(repaired[host], repaired[first], 1);
+	for (i = first; i < n_repaired; ++i) {
+		if (hosts[repaired[i]-nodes] < 0) {
+			hosts[repaired[i]-nodes] = i;
+		}
+		if (i > first) {
+			set_covered(repaired[i-1], repaired[i], 1);
+		}
+	}
+	return 1;
+}
+
+static int add_detour(int host, int first) {
+	if (n_detours == max_detours) {
+		int max_detours_tmp = max_detours ? max_detours*2:N_PATHS_MIN;
+		detour_t *detours_tmp = realloc(detours, sizeof(detour_t)*(size_t)max_detours_tmp);
+		if (!detours_tmp) {
+			fputs("Cannot reallocate memory for detours\n", stderr);
+			fflush(stderr);
+			return 0;
+		}
+		detours = detours_tmp;
+		max_detours = max_detours_tmp;
+	}
+	detours[n_detours].host = host;
+	detours[n_detours].first = first;
+	detours[n_detours].last = n_repaired;
+	++n_detours;
+	return 1;
+}
+
+/* Each detour ends at its host node, the detours are copied after their host in one pass. */
+/* The detours hosted by a node form a list, a stack of the detours being copied handles nesting. */
+
+static int splice_detours(int n_walked) {
+	int n_spliced = 0, n_stacked = 1, i;
+	node_t **spliced = malloc(sizeof(node_t *)*(size_t)n_repaired);
+	int *hosted = malloc(sizeof(int)*(size_t)n_repaired), *stacked = malloc(sizeof(int)*(size_t)(n_detours+1)*2);
+	if (!spliced || !hosted || !stacked) {
+		fputs("Cannot allocate memory for repaired circuit\n", stderr);
+		fflush(stderr);
+		free(stacked);
+		free(hosted);
+		free(spliced);
+		return 0;
+	}
+	for (i = 0; i < n_repaired; ++i) {
+		hosted[i] = -1;
+	}
+
+	/* Lists are built backwards, so that the first detour of a host is stacked last */
+	for (i = 0; i < n_detours; ++i) {
+		detours[i].next = hosted[detours[i].host];
+		hosted[detours[i].host] = i;
+	}
+	stacked[0] = 0;
+	stacked[1] = n_walked;
+	while (n_stacked) {
+		int *top = stacked+(n_stacked-1)*2;
+		if (top[0] == top[1]) {
+			--n_stacked;
+			continue;
+		}
+		spliced[n_spliced++] = repaired[top[0]];
+		for (i = hosted[top[0]++]; i >= 0; i = detours[i].next) {
+			stacked[n_stacked*2] = detours[i].first;
+			stacked[n_stacked*2+1] = detours[i].last;
+			++n_stacked;
+		}
+	}
+	free(stacked);
+	free(hosted);
+	free(repaired);
+	repaired = spliced;
+	max_repaired = n_repaired;
+	return 1;
+}
+
+static void set_covered(node_t *from, node_t *to, int covered) {
+	path_t *path = get_edge_path(from, to);
+	if (path) {
+		path->visited = covered;
+		path->edge->visited = covered;
+	}
+}
+
+/* Appends the nodes of a shortest path from from (excluded) to to (included), walking the BFS tree backwards */
+
+static int add_shortest_path(node_t *from, node_t *to) {
+	int n_repaired_bak = n_repaired, i;
+	node_t *node;
+	if (from == to) {
+		return 1;
+	}
+	if (get_path(from, to)) {
+		return add_repaired_node(to);
+	}
+	from->visited = 1;
+	q_nodes[0] = from;
+	n_q_nodes = 1;
+	for (i = 0; i < n_q_nodes && q_nodes[i] != to; ++i) {
+		add_polarity_nodes(q_nodes[i]);
+	}
+	reset_q_nodes();
+	if (i == n_q_nodes) {
+		return 0;
+	}
+	for (node = to; node != from; node = node->from) {
+		if (!add_repaired_node(node)) {
+			return 0;
+		}
+	}
+	for (i = n_repaired-1; n_repaired_bak < i; --i, ++n_repaired_bak) {
+		node = repaired[i];
+		repaired[i] = repaired[n_repaired_bak];
+		repaired[n_repaired_bak] = node;
+	}
+	return 1;
+}
+
+static int add_repaired_node(node_t *node) {
+	if (n_repaired == max_repaired) {
+		node_t **repaired_tmp = realloc(repaired, sizeof(node_t *)*(size_t)(max_repaired+n_nodes));
+		if (!repaired_tmp) {
+			fputs("Cannot reallocate memory for repaired circuit\n", stderr);
+			fflush(stderr);
+			return 0;
+		}
+		repaired = repaired_tmp;
+		max_repaired += n_nodes;
+	}
+	repaired[n_repaired++] = node;
+	return 1;
+}
+
+static path_t *get_path(node_t *from, node_t *to) {
+	int i;
+	for (i = 0; i < from->n_to_paths && from->to_paths[i].to != to; ++i);
+	return i < from->n_to_paths ? from->to_paths+i:NULL;
+}
+
+static path_t *get_edge_path(node_t *from, node_t *to) {
+	int i;
+	for (i = 0; i < from->n_to_paths && (from->to_paths[i].to != to || !from->to_paths[i].edge); ++i);
+	return i < from->n_to_paths ? from->to_paths+i:NULL;
+}
+
+/* Records a new best circuit, the search then only looks for shorter ones */
+
+static void set_incumbent(node_t **incumbent, int length) {
+	if (incumbent != circuit) {
+		memcpy(circuit, incumbent, sizeof(node_t *)*(size_t)(length+1));
+	}
+	circuit_length = length;
+	if (shared_best) {
+
+		/* Worker process, the circuit is sent to the parent when all starts are searched */
+		if (length < *shared_best) {
+			*shared_best = length;
+		}
+	}
+	else {
+		print_circuit();
+	}
+	min_q_paths = length-1;
+	stats.best_circuit = get_time()-stats.start;
+	if (!stats.n_circuits) {
+		stats.first_circuit = stats.best_circuit;
+	}
+	++stats.n_circuits;
+}
+
+/* Builds a first circuit in CPP mode with the heuristic of Frederickson for the mixed Chinese Postman Problem, */
+/* the best of two circuits is kept: one with the nodes of odd degree first paired along shortest deadhead paths, */
+/* one without. The search then only looks for shorter circuits. */
+
+static int orient_start(node_t *start) {
+	int r;
+	max_oriented_arcs = 0;
+	oriented_arcs = NULL;
+	r = orient_circuit(start, 1);
+	if (r) {
+		r = orient_circuit(start, 0);
+	}
+	if (oriented_arcs) {
+		free(oriented_arcs);
+	}
+	return r;
+}
+
+/* The two-way edges are oriented to leave as little imbalance as possible. Each edge first goes the way that */
+/* suits best its ends, then the edges along augmenting paths are reversed (max flow with unit capacities). */
+/* The imbalance left is deadheaded along shortest paths and the circuit walks the balanced multigraph. */
+/* The polarity and distance of the nodes are used as scratch, the polarity is reset to 0 at the end. */
+
+static int orient_circuit(node_t *start, int pair_odd_nodes) {
+	int r = 1, i, j;
+	n_oriented_arcs = 0;
+	if (pair_odd_nodes) {
+		for (i = 0; i < n_nodes; ++i) {
+			nodes[i].distance = 0;
+		}
+		for (i = 0; i < n_nodes; ++i) {
+			for (j = 0; j < nodes[i].n_to_paths; ++j) {
+				path_t *path = nodes[i].to_paths+j;
+				if (path->edge && (path->to > nodes+i || !is_two_way(path))) {
+					++nodes[i].distance;
+					++path->to->distance;
+				}
+			}
+		}
+		for (i = 0; i < n_nodes && r; ++i) {
+			if (nodes[i].distance%2) {
+				r = pair_odd_node(nodes+i);
+			}
+		}
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		for (j = 0; j < nodes[i].n_to_paths; ++j) {
+			path_t *path = nodes[i].to_paths+j;
+			if (is_two_way(path)) {
+				orient_edge(nodes+i, path);
+			}
+			else if (path->edge) {
+				--nodes[i].polarity;
+				++path->to->polarity;
+			}
+		}
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		while (nodes[i].polarity > 0 && reverse_edges(nodes+i));
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		for (j = 0; j < nodes[i].n_to_paths; ++j) {
+			path_t *path = nodes[i].to_paths+j;
+			if (r > 0 && path->edge && (path->visited || !is_two_way(path))) {
+				r = add_oriented_arc(nodes+i, path->to);
+			}
+			path->visited = 0;
+		}
+	}
+	for (i = 0; i < n_nodes && r > 0; ++i) {
+		while (nodes[i].polarity > 0 && r > 0) {
+			r = add_deadhead_paths(nodes+i);
+		}
+	}
+	if (r > 0) {
+		node_t **oriented = malloc(sizeof(node_t *)*(size_t)(n_oriented_arcs+1));
+		if (oriented) {
+			for (i = n_oriented_arcs; i--; ) {
+				add_pending_path(oriented_arcs+i);
+			}
+			/* The circuit must fit the circuit array and be shorter than the best one, of length min_q_paths+1 */
+			if (walk_pending_paths(oriented, start, n_oriented_arcs) && n_oriented_arcs < max_circuit && n_oriented_arcs <= min_q_paths) {
+				set_incumbent(oriented, n_oriented_arcs);
+			}
+			free(oriented);
+		}
+		else {
+			fputs("Cannot allocate memory for oriented circuit\n", stderr);
+			fflush(stderr);
+			r = 0;
+		}
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		nodes[i].polarity = 0;
+		nodes[i].pending = NULL;
+	}
+	return r != 0;
+}
+
+/* The chosen path of a two-way edge is marked visited, the polarity of its ends then counts this path */
+
+static void orient_edge(node_t *from, path_t *path) {
+	if (path->to < from) {
+		return;
+	}
+	if (from->polarity > path->to->polarity) {
+		path->visited = 1;
+		--from->polarity;
+		++path->to->polarity;
+	}
+	else {
+		get_edge_path(path->to, from)->visited = 1;
+		++from->polarity;
+		--path->to->polarity;
+	}
+}
+
+/* Reversing the edges moves 2 from the polarity of the positive node to the polarity of the last node, */
+/* which is searched so that the total imbalance decreases */
+
+static int reverse_edges(node_t *positive) {
+	int negative = positive->polarity > 1 ? -1:-2, i;
+	positive->visited = 1;
+	q_nodes[0] = positive;
+	n_q_nodes = 1;
+	for (i = 0; i < n_q_nodes && q_nodes[i]->polarity > negative; ++i) {
+		add_reversible_nodes(q_nodes[i]);
+	}
+	reset_q_nodes();
+	if (i < n_q_nodes) {
+		node_t *node;
+		for (node = q_nodes[i]; node != positive; node = node->from) {
+			get_edge_path(node->from, node)->visited = 1;
+			get_edge_path(node, node->from)->visited = 0;
+		}
+		positive->polarity -= 2;
+		q_nodes[i]->polarity += 2;
+		return 1;
+	}
+	return 0;
+}
+
+static void add_reversible_nodes(node_t *from) {
+	int i;
+	for (i = 0; i < from->n_to_paths; ++i) {
+		if (is_two_way(from->to_paths+i) && !from->to_paths[i].visited) {
+			add_polarity_node(from, from->to_paths[i].to);
+		}
+	}
+}
+
+static int is_two_way(const path_t *path) {
+	return path->edge && (path->edge->type == '-' || path->edge->type == '|');
+}
+
+/* Deadheads from the odd node to the nearest odd node, both become even */
+
+static int pair_odd_node(node_t *odd) {
+	int i;
+	odd->visited = 1;
+	q_nodes[0] = odd;
+	n_q_nodes = 1;
+	for (i = 0; i < n_q_nodes && (i == 0 || q_nodes[i]->distance%2 == 0); ++i) {
+		add_polarity_nodes(q_nodes[i]);
+	}
+	reset_q_nodes();
+	if (i < n_q_nodes) {
+		node_t *node;
+		++odd->distance;
+		++q_nodes[i]->distance;
+		--odd->polarity;
+		++q_nodes[i]->polarity;
+		for (node = q_nodes[i]; node != odd; node = node->from) {
+			if (!add_oriented_arc(node->from, node)) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/* Deadheads from the positive node to the nearest negative node, all paths may be walked. */
+/* Returns -1 if no negative node can be reached, the search then starts without circuit. */
+
+static int add_deadhead_paths(node_t *positive) {
+	int i;
+	positive->visited = 1;
+	q_nodes[0] = positive;
+	n_q_nodes = 1;
+	for (i = 0; i < n_q_nodes && q_nodes[i]->polarity >= 0; ++i) {
+		add_polarity_nodes(q_nodes[i]);
+	}
+	reset_q_nodes();
+	if (i < n_q_nodes) {
+		node_t *node;
+		--positive->polarity;
+		++q_nodes[i]->polarity;
+		for (node = q_nodes[i]; node != positive; node = node->from) {
+			if (!add_oriented_arc(node->from, node)) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+	fputs("Cannot deadhead oriented circuit\n", stderr);
+	fflush(stderr);
+	return -1;
+}
+
+static int add_oriented_arc(node_t *from, node_t *to) {
+	if (n_oriented_arcs == max_oriented_arcs) {
+		int max_arcs = max_oriented_arcs ? max_oriented_arcs*2:n_nodes;
+		path_t *arcs_tmp = realloc(oriented_arcs, sizeof(path_t)*(size_t)max_arcs);
+		if (!arcs_tmp) {
+			fputs("Cannot reallocate memory for oriented arcs\n", stderr);
+			fflush(stderr);
+			return 0;
+		}
+		oriented_arcs = arcs_tmp;
+		max_oriented_arcs = max_arcs;
+	}
+	set_path(oriented_arcs+n_oriented_arcs, from, NULL, to);
+	++n_oriented_arcs;
+	return 1;
+}
+
+/* Searches from every node that has at least one path, the start nodes are distributed to n_workers */
+/* processes that inherit the city after polarity reduction. The length of the best circuit is shared */
+/* between workers so that each search is bounded by the best circuit found by any of them. */
+/* Concurrent updates may lose an improvement, this only makes the bound weaker for a while */
+
+static int search_all_starts(void) {
+	int *shared_map, best_worker = -1, best_length = n_paths+1, r = 1, i;
+	node_t **best;
+	FILE **results;
+	pid_t *workers;
+	int zero = open("/dev/zero", O_RDWR);
+	if (zero == -1) {
+		fputs("Cannot open /dev/zero\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	shared_map = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED, zero, 0);
+	close(zero);
+	if (shared_map == MAP_FAILED) {
+		fputs("Cannot map shared best length\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+
+	/* No circuit found yet, the workers keep min_q_paths at n_paths+1 until one is shared */
+	*shared_map = n_paths+2;
+	workers = malloc(sizeof(pid_t)*(size_t)n_workers);
+	results = calloc((size_t)n_workers, sizeof(FILE *));
+	best = malloc(sizeof(node_t *)*(size_t)(n_paths+1));
+	if (!workers || !results || !best) {
+		fputs("Cannot allocate memory for workers\n", stderr);
+		fflush(stderr);
+		free(best);
+		free(results);
+		free(workers);
+		munmap(shared_map, sizeof(int));
+		return 0;
+	}
+	shared_best = shared_map;
+	if (run_workers(n_workers, workers, results, search_starts, write_start_jobs)) {
+		stats_t worker_stats;
+		for (i = 0; i < n_workers; ++i) {
+			int length;
+
+			/* Results are read in worker order, the circuit of the best worker so far is kept */
+			if (read_worker_result(results[i], &length, &worker_stats)) {
+				add_worker_stats(&worker_stats);
+				if (length >= 0 && (length < best_length || (length == best_length && circuit[0] < best[0]))) {
+					best_length = length;
+					best_worker = i;
+					memcpy(best, circuit, sizeof(node_t *)*(size_t)(length+1));
+					stats.best_circuit = worker_stats.best_circuit;
+				}
+			}
+			else {
+				r = 0;
+			}
+		}
+	}
+	else {
+		r = 0;
+	}
+	for (i = 0; i < n_workers; ++i) {
+		int status;
+		if (results[i]) {
+			fclose(results[i]);
+		}
+		if (workers[i] > 0 && (waitpid(workers[i], &status, 0) != workers[i] || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)) {
+			r = 0;
+		}
+	}
+	shared_best = NULL;
+	munmap(shared_map, sizeof(int));
+	free(results);
+	free(workers);
+	if (!r) {
+		fputs("Worker failed\n", stderr);
+		fflush(stderr);
+		free(best);
+		return 0;
+	}
+	if (best_worker >= 0) {
+		memcpy(circuit, best, sizeof(node_t *)*(size_t)(best_length+1));
+		circuit_length = best_length;
+		min_q_paths = best_length-1;
+		fputs("Best start", stdout);
+		print_node(circuit[0]);
+		puts("");
+		print_circuit();
+	}
+	free(best);
+	return 1;
+}
+
+/* Forks the workers, each one reads jobs from the jobs pipe and writes its result to its own pipe */
+
+static int run_workers(int n, pid_t *workers, FILE **results, void (*work)(int, FILE *), int (*write_jobs)(int)) {
+	int jobs[2], i;
+	if (pipe(jobs) == -1) {
+		fputs("Cannot create jobs pipe\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	fflush(stdout);
+	if (stats_file) {
+		fflush(stats_file);
+	}
+	for (i = 0; i < n; ) {
+		int result[2];
+		workers[i] = -1;
+		if (pipe(result) == -1) {
+			fputs("Cannot create result pipe\n", stderr);
+			fflush(stderr);
+			break;
+		}
+		workers[i] = fork();
+		if (workers[i] == -1) {
+			fputs("Cannot create worker process\n", stderr);
+			fflush(stderr);
+			close(result[0]);
+			close(result[1]);
+			break;
+		}
+		if (!workers[i]) {
+			FILE *result_file;
+			close(jobs[1]);
+			close(result[0]);
+			result_file = fdopen(result[1], "w");
+			if (!result_file) {
+				_exit(EXIT_FAILURE);
+			}
+			work(jobs[0], result_file);
+			_exit(fclose(result_file) ? EXIT_FAILURE:EXIT_SUCCESS);
+		}
+		close(result[1]);
+		results[i++] = fdopen(result[0], "r");
+		if (!results[i-1]) {
+			close(result[0]);
+			break;
+		}
+	}
+	close(jobs[0]);
+	if (i < n) {
+		close(jobs[1]);
+		for (; i < n; ++i) {
+			workers[i] = -1;
+		}
+		return 0;
+	}
+	return write_jobs(jobs[1]);
+}
+
+static int write_start_jobs(int jobs) {
+	int i;
+	for (i = 0; i < n_nodes; ++i) {
+		if (nodes[i].n_to_paths && write(jobs, &i, sizeof(int)) != (ssize_t)sizeof(int)) {
+			fputs("Cannot write start node\n", stderr);
+			fflush(stderr);
+			close(jobs);
+			return 0;
+		}
+	}
+	close(jobs);
+	return 1;
+}
+
+/* Worker process, each read from the jobs pipe takes one start node */
+
+static void search_starts(int jobs, FILE *result) {
+	int start_index;
+	path_t path;
+	snapshot_calls = 0;
+	while (read(jobs, &start_index, sizeof(int)) == (ssize_t)sizeof(int)) {
+		node_t *start = nodes+start_index;
+		if (*shared_best <= min_q_paths) {
+			min_q_paths = *shared_best-1;
+		}
+		set_path(&path, NULL, NULL, start);
+		q_paths[0] = &path;
+		n_q_paths = 0;
+		low_q_paths = n_paths;
+		add_call(0, start, &path);
+		search(start);
+	}
+	close(jobs);
+	write_worker_result(result);
+}
+
+static void write_worker_result(FILE *result) {
+	int i;
+	fwrite(&circuit_length, sizeof(int), (size_t)1, result);
+	for (i = 0; i <= circuit_length; ++i) {
+		int node_index = (int)(circuit[i]-nodes);
+		fwrite(&node_index, sizeof(int), (size_t)1, result);
+	}
+	fwrite(&stats, sizeof(stats_t), (size_t)1, result);
+}
+
+static int read_worker_result(FILE *result, int *length, stats_t *worker_stats) {
+	int i;
+	if (fread(length, sizeof(int), (size_t)1, result) != 1 || *length < -1 || *length > n_paths) {
+		return 0;
+	}
+	for (i = 0; i <= *length; ++i) {
+		int node_index;
+		if (fread(&node_index, sizeof(int), (size_t)1, result) != 1 || node_index < 0 || node_index >= n_nodes) {
+			return 0;
+		}
+		circuit[i] = nodes+node_index;
+	}
+	return fread(worker_stats, sizeof(stats_t), (size_t)1, result) == 1;
+}
+
+static void add_worker_stats(const stats_t *worker_stats) {
+	int i;
+	if (worker_stats->n_circuits && (!stats.n_circuits || worker_stats->first_circuit < stats.first_circuit)) {
+		stats.first_circuit = worker_stats->first_circuit;
+	}
+	stats.n_circuits += worker_stats->n_circuits;
+	for (i = 0; i < N_CALL_TYPES; ++i) {
+		stats.calls[i] += worker_stats->calls[i];
+	}
+	for (i = 0; i < N_PRUNES; ++i) {
+		stats.prunes[i] += worker_stats->prunes[i];
+	}
+	for (i = 0; i < N_BFS_CALLERS; ++i) {
+		stats.bfs_expansions[i] += worker_stats->bfs_expansions[i];
+	}
+}
+
+/* District mode, the grid is cut into rectangular districts balanced by the number of required edges (arcs in */
+/* Manhattan mode), each one is searched by its own worker process within the time budget. Only the edges of the */
+/* district are required in its search, the other ones may still be used to deadhead. The district circuits are */
+/* then spliced at a node they share with the circuit built so far, any edge left uncovered (district without */
+/* circuit) is covered by a detour as in warm start, and the stitched length is printed with a lower bound. */
+
+static int solve_districts(node_t *start) {
+	int lower_bound, best_length = -1, r = 1, *district_lengths, *hosts, i, j;
+	node_t ***district_circuits;
+	FILE **results;
+	pid_t *workers;
+	districts = malloc(sizeof(int)*(size_t)n_nodes);
+	district_starts = calloc((size_t)n_districts, sizeof(node_t *));
+	district_circuits = calloc((size_t)n_districts, sizeof(node_t **));
+	district_lengths = malloc(sizeof(int)*(size_t)n_districts);
+	workers = malloc(sizeof(pid_t)*(size_t)n_districts);
+	results = calloc((size_t)n_districts, sizeof(FILE *));
+	hosts = malloc(sizeof(int)*(size_t)n_nodes);
+	if (!districts || !district_starts || !district_circuits || !district_lengths || !workers || !results || !hosts) {
+		fputs("Cannot allocate memory for districts\n", stderr);
+		fflush(stderr);
+		free(hosts);
+		free(results);
+		free(workers);
+		free(district_lengths);
+		free(district_circuits);
+		return 0;
+	}
+	for (i = 0; i < n_districts; ++i) {
+		district_lengths[i] = -2;
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		nodes[i].distance = 0;
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		for (j = 0; j < nodes[i].n_to_paths; ++j) {
+			if (is_required(nodes+i, nodes[i].to_paths+j)) {
+				++nodes[i].distance;
+			}
+		}
+	}
+	set_districts(0, n_nodes/n_avenues, 0, n_avenues, 0, n_districts);
+	for (i = 0; i < n_nodes; ++i) {
+		for (j = 0; j < nodes[i].n_to_paths; ++j) {
+			if (is_required(nodes+i, nodes[i].to_paths+j)) {
+				int district = get_district(nodes+i, nodes[i].to_paths[j].to);
+				if (!district_starts[district]) {
+					district_starts[district] = nodes+i;
+				}
+			}
+		}
+	}
+	district_starts[districts[start-nodes]] = start;
+	if (run_workers(n_districts, workers, results, search_district, write_district_jobs)) {
+		stats_t worker_stats;
+		for (i = 0; i < n_districts && r; ++i) {
+			int district;
+
+			/* Each worker takes exactly one district, -2 marks the districts not received yet */
+			if (fread(&district, sizeof(int), (size_t)1, results[i]) == 1 && district >= 0 && district < n_districts && district_lengths[district] == -2 && read_worker_result(results[i], district_lengths+district, &worker_stats)) {
+				add_worker_stats(&worker_stats);
+				if (district_lengths[district] >= 0) {
+					district_circuits[district] = malloc(sizeof(node_t *)*(size_t)(district_lengths[district]+1));
+					if (district_circuits[district]) {
+						memcpy(district_circuits[district], circuit, sizeof(node_t *)*(size_t)(district_lengths[district]+1));
+					}
+					else {
+						fputs("Cannot allocate memory for district circuit\n", stderr);
+						fflush(stderr);
+						r = 0;
+					}
+				}
+			}
+			else {
+				r = 0;
+			}
+		}
+	}
+	else {
+		r = 0;
+	}
+	for (i = 0; i < n_districts && r; ++i) {
+		printf("District %d length %d\n", i+1, district_lengths[i]);
+	}
+	fflush(stdout);
+	for (i = 0; i < n_districts; ++i) {
+		int status;
+		if (results[i]) {
+			fclose(results[i]);
+		}
+		if (workers[i] > 0 && (waitpid(workers[i], &status, 0) != workers[i] || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)) {
+			r = 0;
+		}
+	}
+	free(results);
+	free(workers);
+	if (r) {
+		for (i = 0; i < n_nodes; ++i) {
+			hosts[i] = -1;
+		}
+		hosts[start-nodes] = 0;
+		n_repaired = 0;
+		n_detours = 0;
+		r = add_repaired_node(start);
+		j = districts[start-nodes];
+		if (r && district_circuits[j]) {
+			r = stitch_district(district_circuits[j], district_lengths[j], hosts);
+		}
+		for (i = 0; i < n_districts && r; ++i) {
+			if (i != j && district_circuits[i]) {
+				r = stitch_district(district_circuits[i], district_lengths[i], hosts);
+			}
+		}
+		if (r && n_detours) {
+			r = splice_detours(1);
+		}
+		if (r && !repair_circuit(start)) {
+			fputs("Cannot cover the edges left by the districts\n", stderr);
+			fflush(stderr);
+			r = 0;
+		}
+		if (r && n_repaired > max_circuit) {
+			node_t **circuit_tmp = realloc(circuit, sizeof(node_t *)*(size_t)n_repaired);
+			if (circuit_tmp) {
+				circuit = circuit_tmp;
+				max_circuit = n_repaired;
+			}
+			else {
+				fputs("Cannot reallocate memory for circuit\n", stderr);
+				fflush(stderr);
+				r = 0;
+			}
+		}
+		if (r) {
+			best_length = n_repaired-1;
+		}
+	}
+	else {
+		fputs("Worker failed\n", stderr);
+		fflush(stderr);
+	}
+	for (i = 0; i < n_districts; ++i) {
+		if (district_circuits[i]) {
+			free(district_circuits[i]);
+		}
+	}
+	free(district_circuits);
+	free(district_lengths);
+	free(hosts);
+	if (best_length < 0) {
+		return 0;
+	}
+	memcpy(circuit, repaired, sizeof(node_t *)*(size_t)(best_length+1));
+	circuit_length = best_length;
+
+	/* The deadhead paths of a district may walk edges covered by another one, the local search removes them */
+	if (!local_search(get_time()+district_seconds)) {
+		return 0;
+	}
+	best_length = circuit_length;
+	print_circuit();
+	lower_bound = get_lower_bound();
+	printf("Lower bound %d\nGap %.2f%%\n", lower_bound, lower_bound ? (double)(best_length-lower_bound)*100/lower_bound:0.0);
+	fflush(stdout);
+	return 1;
+}
+
+/* Recursive bisection of the rectangle across its longest side, the weight of a node is the number of */
+/* required edges it owns, a district may be empty if the rectangle cannot be cut anymore */
+
+static void set_districts(int street_min, int street_max, int avenue_min, int avenue_max, int first, int n) {
+	int n_first = n/2, total, weight, cut;
+	if (n == 1 || (street_max-street_min == 1 && avenue_max-avenue_min == 1)) {
+		int i;
+		for (i = street_min; i < street_max; ++i) {
+			int j;
+			for (j = avenue_min; j < avenue_max; ++j) {
+				districts[i*n_avenues+j] = first;
+			}
+		}
+		return;
+	}
+	if (street_max-street_min >= avenue_max-avenue_min) {
+		total = get_rectangle_weight(street_min, street_max, avenue_min, avenue_max);
+		weight = 0;
+		for (cut = street_min+1; cut < street_max-1; ++cut) {
+			weight += get_rectangle_weight(cut-1, cut, avenue_min, avenue_max);
+			if ((long)weight*n >= (long)total*n_first) {
+				break;
+			}
+		}
+		set_districts(street_min, cut, avenue_min, avenue_max, first, n_first);
+		set_districts(cut, street_max, avenue_min, avenue_max, first+n_first, n-n_first);
+	}
+	else {
+		total = get_rectangle_weight(street_min, street_max, avenue_min, avenue_max);
+		weight = 0;
+		for (cut = avenue_min+1; cut < avenue_max-1; ++cut) {
+			weight += get_rectangle_weight(street_min, street_max, cut-1, cut);
+			if ((long)weight*n >= (long)total*n_first) {
+				break;
+			}
+		}
+		set_districts(street_min, street_max, avenue_min, cut, first, n_first);
+		set_districts(street_min, street_max, cut, avenue_max, first+n_first, n-n_first);
+	}
+}
+
+static int get_rectangle_weight(int street_min, int street_max, int avenue_min, int avenue_max) {
+	int weight = 0, i;
+	for (i = street_min; i < street_max; ++i) {
+		int j;
+		for (j = avenue_min; j < avenue_max; ++j) {
+			weight += nodes[i*n_avenues+j].distance;
+		}
+	}
+	return weight;
+}
+
+/* An edge belongs to the district of its north or west end */
+
+static int get_district(const node_t *a, const node_t *b) {
+	return districts[(a < b ? a:b)-nodes];
+}
+
+/* Each required edge is counted once in CPP mode (two-way edges have 2 paths), each arc in Manhattan mode */
+
+static int is_required(const node_t *from, const path_t *path) {
+	return path->edge && (manhattan || !is_two_way(path) || path->to > from);
+}
+
+static int write_district_jobs(int jobs) {
+	int i;
+	for (i = 0; i < n_districts; ++i) {
+		if (write(jobs, &i, sizeof(int)) != (ssize_t)sizeof(int)) {
+			fputs("Cannot write district\n", stderr);
+			fflush(stderr);
+			close(jobs);
+			return 0;
+		}
+	}
+	close(jobs);
+	return 1;
+}
+
+/* Worker process, takes one district from the jobs pipe and searches it in its own copy of the city, */
+/* reduced to the paths of the district and their own deadhead paths. Its output is discarded. */
+
+static void search_district(int jobs, FILE *result) {
+	int district, null_output = open("/dev/null", O_WRONLY);
+	path_t path;
+	if (null_output != -1) {
+		dup2(null_output, STDOUT_FILENO);
+		close(null_output);
+	}
+	snapshot_calls = 0;
+	if (read(jobs, &district, sizeof(int)) != (ssize_t)sizeof(int)) {
+		close(jobs);
+		return;
+	}
+	close(jobs);
+	fwrite(&district, sizeof(int), (size_t)1, result);
+	circuit_length = -1;
+	if (!set_district_paths(district, district_starts[district])) {
+		write_worker_result(result);
+		return;
+	}
+	if (low_bound) {
+		node_t *start = district_starts[district];
+		set_path(&path, NULL, NULL, start);
+		q_paths[0] = &path;
+		n_q_paths = 0;
+		low_q_paths = n_paths;
+		if (orient && !manhattan && !orient_start(start)) {
+			circuit_length = -1;
+			write_worker_result(result);
+			return;
+		}
+		add_call(0, start, &path);
+		search_deadline = get_time()+district_seconds;
+		search(start);
+	}
+	write_worker_result(result);
+}
+
+/* The deadhead paths of the city were added to balance the whole city, they are replaced by the ones */
+/* balancing the paths of the district. Deadhead paths may walk any street, as the shortest paths do. */
+
+static int set_district_paths(int district, node_t *start) {
+	int i;
+	n_paths = 0;
+	low_bound = 0;
+	for (i = 0; i < n_nodes; ++i) {
+		nodes[i].polarity = 0;
+		nodes[i].n_from_paths = 0;
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		int n_district_paths = 0, j;
+		for (j = 0; j < nodes[i].n_to_paths; ++j) {
+			path_t *path = nodes[i].to_paths+j;
+			if (path->edge && get_district(nodes+i, path->to) == district) {
+				if (is_required(nodes+i, path)) {
+					++low_bound;
+				}
+				--nodes[i].polarity;
+				++path->to->polarity;
+				nodes[i].to_paths[n_district_paths++] = *path;
+				++n_paths;
+			}
+		}
+		nodes[i].n_to_paths = n_district_paths;
+	}
+	if (!low_bound) {
+		return 1;
+	}
+	for (i = 0; i < n_nodes && nodes[i].polarity <= 0; ++i);
+	while (i < n_nodes) {
+		if (!reduce_polarity(nodes+i)) {
+			return 0;
+		}
+		for (; i < n_nodes && nodes[i].polarity <= 0; ++i);
+	}
+	if (!connect_district(start)) {
+		return 0;
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		if (!manhattan) {
+			set_reverse_paths(nodes+i);
+		}
+		if (!add_from_paths(nodes+i)) {
+			return 0;
+		}
+	}
+	return set_search_arrays();
+}
+
+/* A balanced district is strongly connected when it is connected, each part not reached from the */
+/* start node is joined to the nearest reached node by a round trip of deadhead paths */
+
+static int connect_district(node_t *start) {
+	int *reached = calloc((size_t)n_nodes, sizeof(int)), r = 1, i;
+	if (!reached) {
+		fputs("Cannot allocate memory for district nodes\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	set_reached_nodes(start, reached);
+	for (i = 0; i < n_nodes && r; ++i) {
+		if (nodes[i].n_to_paths && !reached[i]) {
+			int j;
+			nodes[i].visited = 1;
+			q_nodes[0] = nodes+i;
+			n_q_nodes = 1;
+			for (j = 0; j < n_q_nodes && !reached[q_nodes[j]-nodes]; ++j) {
+				add_polarity_nodes(q_nodes[j]);
+			}
+			reset_q_nodes();
+			if (j < n_q_nodes) {
+				node_t *node = q_nodes[j];
+				r = add_tree_paths(nodes+i, node);
+				if (r) {
+					node->visited = 1;
+					q_nodes[0] = node;
+					n_q_nodes = 1;
+					for (j = 0; j < n_q_nodes && q_nodes[j] != nodes+i; ++j) {
+						add_polarity_nodes(q_nodes[j]);
+					}
+					reset_q_nodes();
+					r = add_tree_paths(node, nodes+i);
+				}
+				set_reached_nodes(nodes+i, reached);
+			}
+			else {
+				fputs("Cannot connect district\n", stderr);
+				fflush(stderr);
+				r = 0;
+			}
+		}
+	}
+	free(reached);
+	return r;
+}
+
+static void set_reached_nodes(node_t *from, int *reached) {
+	int i;
+	if (reached[from-nodes]) {
+		return;
+	}
+	reached[from-nodes] = 1;
+	q_nodes[0] = from;
+	n_q_nodes = 1;
+	for (i = 0; i < n_q_nodes; ++i) {
+		int j;
+		for (j = 0; j < q_nodes[i]->n_to_paths; ++j) {
+			node_t *to = q_nodes[i]->to_paths[j].to;
+			if (!reached[to-nodes]) {
+				reached[to-nodes] = 1;
+				q_nodes[n_q_nodes++] = to;
+			}
+		}
+	}
+}
+
+/* Adds deadhead paths from root to node along the tree of the last BFS */
+
+static int add_tree_paths(node_t *root, node_t *node) {
+	for (; node != root; node = node->from) {
+		if (!add_to_path(node->from, NULL, node)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* A district circuit is appended as a detour, as in warm start, hosted by the first walk of a node */
+/* it shares with the circuit built so far, or by the start node with shortest paths to and from the */
+/* district. The detours are spliced in one pass once all districts are stitched. */
+
+static int stitch_district(node_t **district_circuit, int length, int *hosts) {
+	int host = -1, first = n_repaired, splice = 0, r = 1, i;
+	for (i = length; i--; ) {
+		int walked = hosts[district_circuit[i]-nodes];
+		if (walked >= 0 && (host < 0 || walked <= host)) {
+			host = walked;
+			splice = i;
+		}
+	}
+	if (host >= 0) {
+
+		/* The district circuit is walked from its first visit of the splice node */
+		for (i = splice; i < length && r; ++i) {
+			r = add_repaired_node(district_circuit[i+1]);
+		}
+		for (i = 1; i <= splice && r; ++i) {
+			r = add_repaired_node(district_circuit[i]);
+		}
+	}
+	else {
+		host = 0;
+		r = add_shortest_path(repaired[0], district_circuit[0]);
+		for (i = 1; i <= length && r; ++i) {
+			r = add_repaired_node(district_circuit[i]);
+		}
+		r = r && add_shortest_path(district_circuit[length], repaired[0]);
+	}
+	if (!r || !add_detour(host, first)) {
+		return 0;
+	}
+	for (i = first; i < n_repaired; ++i) {
+		if (hosts[repaired[i]-nodes] < 0) {
+			hosts[repaired[i]-nodes] = i;
+		}
+	}
+	return 1;
+}
+
+/* Each deadhead path changes the imbalance of 2 nodes by 1: a node with more incoming than outgoing */
+/* one-way edges (arcs in Manhattan mode) needs at least as many deadhead paths from it as it has */
+/* extra incoming edges that its two-way edges cannot absorb, the same for outgoing edges, and a node of */
+/* odd degree needs at least one deadhead path (CPP mode) */
+
+static int get_lower_bound(void) {
+	int excess_in = 0, excess_out = 0, n_odd = 0, i;
+	for (i = 0; i < n_nodes; ++i) {
+		nodes[i].distance = 0;
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		int j;
+		for (j = 0; j < nodes[i].n_to_paths; ++j) {
+			path_t *path = nodes[i].to_paths+j;
+			if (!manhattan && is_two_way(path)) {
+				++nodes[i].distance;
+			}
+			else if (path->edge) {
+				--nodes[i].polarity;
+				++path->to->polarity;
+			}
+		}
+	}
+	for (i = 0; i < n_nodes; ++i) {
+		if (nodes[i].polarity > nodes[i].distance) {
+			excess_in += nodes[i].polarity-nodes[i].distance;
+		}
+		else if (nodes[i].polarity < -nodes[i].distance) {
+			excess_out += -nodes[i].polarity-nodes[i].distance;
+		}
+		if ((nodes[i].polarity+nodes[i].distance)%2) {
+			++n_odd;
+		}
+		nodes[i].polarity = 0;
+	}
+	if (excess_out > excess_in) {
+		excess_in = excess_out;
+	}
+	if (n_odd/2 > excess_in) {
+		excess_in = n_odd/2;
+	}
+	return (manhattan ? n_initial_paths:n_open_edges)+excess_in;
+}
+
+/* Local search on the best circuit, the first walk of each edge (arc in Manhattan mode) covers it and the other */
+/* steps are deadhead steps. Each run of deadhead steps is replaced by a shortest path between its ends, then in */
+/* CPP mode the steps between two runs are walked backwards when they only use two-way edges and the shortest */
+/* paths between the ends of the runs exchanged this way are shorter (2-opt move). Both passes are repeated */
+/* until none helps or the time budget runs out. */
+
+static int improve_circuit(void) {
+	int length = circuit_length;
+	if (!local_search(get_time()+local_seconds)) {
+		return 0;
+	}
+	if (circuit_length < length) {
+		printf("Local search gain %d\n", length-circuit_length);
+		print_circuit();
+	}
+	return 1;
+}
+
+static int local_search(double deadline) {
+	int gain;
+	int *required;
+	if (circuit_length < 1) {
+		return 1;
+	}
+	required = malloc(sizeof(int)*(size_t)circuit_length);
+	if (!required) {
+		fputs("Cannot allocate memory for local search\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	do {
+		set_required_steps(required);
+		gain = reroute_deadheads(required, deadline);
+		if (gain >= 0 && !manhattan) {
+			int reverse_gain;
+			set_required_steps(required);
+			reverse_gain = reverse_segments(required, deadline);
+			gain = reverse_gain >= 0 ? gain+reverse_gain:-1;
+		}
+	}
+	while (gain > 0 && get_time() < deadline);
+	free(required);
+	return gain >= 0;
+}
+
+static void set_required_steps(int *required) {
+	int i;
+	for (i = 0; i < circuit_length; ++i) {
+		path_t *path = get_edge_path(circuit[i], circuit[i+1]);
+		if (manhattan) {
+			required[i] = !path->visited;
+			path->visited = 1;
+		}
+		else {
+			required[i] = !path->edge->visited;
+			path->edge->visited = 1;
+		}
+	}
+	for (i = 0; i < circuit_length; ++i) {
+		path_t *path = get_edge_path(circuit[i], circuit[i+1]);
+		path->visited = 0;
+		path->edge->visited = 0;
+	}
+}
+
+/* The circuit is rebuilt in the repaired circuit array then copied back, returns the gain or -1 */
+
+static int reroute_deadheads(const int *required, double deadline) {
+	int i = 0;
+	n_repaired = 0;
+	if (!add_repaired_node(circuit[0])) {
+		return -1;
+	}
+	while (i < circuit_length) {
+		int run_end, distance;
+		if (required[i]) {
+			if (!add_repaired_node(circuit[++i])) {
+				return -1;
+			}
+			continue;
+		}
+		for (run_end = i+1; run_end < circuit_length && !required[run_end]; ++run_end);
+		distance = get_time() < deadline ? get_shortest_distance(circuit[i], circuit[run_end], run_end-i-1):-1;
+		if (distance >= 0) {
+			if (!add_shortest_path(circuit[i], circuit[run_end])) {
+				return -1;
+			}
+		}
+		else if (!add_circuit_nodes(i+1, run_end)) {
+			return -1;
+		}
+		i = run_end;
+	}
+	i = circuit_length-(n_repaired-1);
+	memcpy(circuit, repaired, sizeof(node_t *)*(size_t)n_repaired);
+	circuit_length = n_repaired-1;
+	return i;
+}
+
+/* Runs a1..b1 and a2..b2 around the steps b1..a2 become a1..a2, a2..b1 walked backwards, then b1..b2 */
+
+static int reverse_segments(const int *required, double deadline) {
+	int i = 0;
+	n_repaired = 0;
+	if (!add_repaired_node(circuit[0])) {
+		return -1;
+	}
+	while (i < circuit_length) {
+		int run_end, next_run, next_run_end;
+		if (required[i]) {
+			if (!add_repaired_node(circuit[++i])) {
+				return -1;
+			}
+			continue;
+		}
+		for (run_end = i+1; run_end < circuit_length && !required[run_end]; ++run_end);
+		for (next_run = run_end; next_run < circuit_length && required[next_run]; ++next_run);
+		if (next_run < circuit_length && get_time() < deadline && is_reversible(run_end, next_run)) {
+			int distance1, distance2 = -1, old_length;
+			for (next_run_end = next_run+1; next_run_end < circuit_length && !required[next_run_end]; ++next_run_end);
+			old_length = run_end-i+next_run_end-next_run;
+			distance1 = get_shortest_distance(circuit[i], circuit[next_run], old_length-1);
+			if (distance1 >= 0) {
+				distance2 = get_shortest_distance(circuit[run_end], circuit[next_run_end], old_length-1-distance1);
+			}
+			if (distance2 >= 0) {
+				int j;
+				if (!add_shortest_path(circuit[i], circuit[next_run])) {
+					return -1;
+				}
+				for (j = next_run; j-- > run_end; ) {
+					if (!add_repaired_node(circuit[j])) {
+						return -1;
+					}
+				}
+				if (!add_shortest_path(circuit[run_end], circuit[next_run_end])) {
+					return -1;
+				}
+				i = next_run_end;
+				continue;
+			}
+		}
+		if (!add_circuit_nodes(i+1, run_end)) {
+			return -1;
+		}
+		i = run_end;
+	}
+	i = circuit_length-(n_repaired-1);
+	memcpy(circuit, repaired, sizeof(node_t *)*(size_t)n_repaired);
+	circuit_length = n_repaired-1;
+	return i;
+}
+
+static int is_reversible(int first, int last) {
+	int i;
+	for (i = first; i < last && is_two_way(get_edge_path(circuit[i], circuit[i+1])); ++i);
+	return i == last;
+}
+
+static int add_circuit_nodes(int first, int last) {
+	int i;
+	for (i = first; i <= last && add_repaired_node(circuit[i]); ++i);
+	return i > last;
+}
+
+/* BFS on all paths limited to max_distance, returns -1 if the node to reach is farther */
+
+static int get_shortest_distance(node_t *from, node_t *to, int max_distance) {
+	int i;
+	init_q_nodes(from, 1, 0);
+	for (i = 0; i < n_q_nodes && q_nodes[i] != to && q_nodes[i]->distance < max_distance; ++i) {
+		add_distance_nodes3(q_nodes[i]);
+	}
+	reset_q_nodes();
+	for (; i < n_q_nodes && q_nodes[i] != to; ++i);
+	return i < n_q_nodes && to->distance <= max_distance ? to->distance:-1;
+}
+
+/* Batch mode, the cities read from standard input are solved by a pool of worker processes. */
+/* Each worker solves one city at a time and keeps its buffers for the next one, its output */
+/* is collected by the parent and printed in input order, followed by status and time. */
+
+static int solve_batch(void) {
+	int n_busy, i;
+	batch_worker_t *workers = malloc(sizeof(batch_worker_t)*(size_t)n_batch_workers);
+	if (!workers) {
+		fputs("Cannot allocate memory for batch workers\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	n_batch_instances = 0;
+	n_batch_printed = 0;
+	max_batch_outputs = 0;
+	batch_end = 0;
+	batch_status = EXIT_SUCCESS;
+	fflush(stdout);
+	for (i = 0; i < n_batch_workers && start_batch_worker(workers+i, i); ++i);
+	if (i < n_batch_workers) {
+		n_batch_workers = i;
+		batch_status = EXIT_FAILURE;
+	}
+	n_busy = give_batch_instances(workers);
+	while (n_busy > 0 && batch_end >= 0) {
+		int max_fd = -1;
+		fd_set ready;
+		FD_ZERO(&ready);
+		for (i = 0; i < n_batch_workers; ++i) {
+			if (workers[i].instance >= 0) {
+				FD_SET(workers[i].results, &ready);
+				if (workers[i].results > max_fd) {
+					max_fd = workers[i].results;
+				}
+			}
+		}
+		if (select(max_fd+1, &ready, NULL, NULL, NULL) == -1) {
+			fputs("Cannot wait for batch workers\n", stderr);
+			fflush(stderr);
+			batch_status = EXIT_FAILURE;
+			break;
+		}
+		for (i = 0; i < n_batch_workers && batch_end >= 0; ++i) {
+			if (workers[i].instance >= 0 && FD_ISSET(workers[i].results, &ready)) {
+				int r = read_batch_output(workers+i);
+				if (r > 0) {
+					end_batch_instance(workers+i);
+				}
+				else if (r < 0) {
+					batch_end = -1;
+				}
+			}
+		}
+		print_batch_outputs();
+		n_busy = give_batch_instances(workers);
+	}
+	print_batch_outputs();
+	if (!batch_end) {
+		fputs("No batch worker left\n", stderr);
+		fflush(stderr);
+		batch_status = EXIT_FAILURE;
+	}
+	else if (batch_end < 0) {
+		batch_status = EXIT_FAILURE;
+	}
+	for (i = 0; i < n_batch_workers; ++i) {
+		stop_batch_worker(workers+i);
+	}
+	for (i = n_batch_printed; i < n_batch_instances; ++i) {
+		if (batch_outputs[i]) {
+			free(batch_outputs[i]);
+		}
+	}
+	if (batch_outputs) {
+		free(batch_outputs);
+	}
+	if (batch_input) {
+		free(batch_input);
+	}
+	free(workers);
+	return batch_status;
+}
+
+/* Reads the next city for each idle worker, returns the number of busy workers */
+
+static int give_batch_instances(batch_worker_t *workers) {
+	int n_busy = 0, i;
+	for (i = 0; i < n_batch_workers; ++i) {
+		if (workers[i].pid > 0 && workers[i].instance < 0 && !batch_end) {
+			int r = read_batch_instance();
+			if (r > 0) {
+				send_batch_instance(workers+i, n_batch_instances);
+			}
+			else {
+				if (r < 0) {
+					fputs("Invalid batch instance\n", stderr);
+					fflush(stderr);
+					batch_status = EXIT_FAILURE;
+				}
+				batch_end = 1;
+			}
+		}
+		if (workers[i].instance >= 0) {
+			++n_busy;
+		}
+	}
+	return n_busy;
+}
+
+static int start_batch_worker(batch_worker_t *worker, int index) {
+	int jobs[2], results[2], i;
+	if (pipe(jobs) == -1) {
+		fputs("Cannot create batch jobs pipe\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	if (pipe(results) == -1) {
+		fputs("Cannot create batch results pipe\n", stderr);
+		fflush(stderr);
+		close(jobs[0]);
+		close(jobs[1]);
+		return 0;
+	}
+	worker->pid = fork();
+	if (worker->pid == -1) {
+		fputs("Cannot create batch worker process\n", stderr);
+		fflush(stderr);
+		close(results[0]);
+		close(results[1]);
+		close(jobs[0]);
+		close(jobs[1]);
+		return 0;
+	}
+	if (!worker->pid) {
+
+		/* The pipes of the workers started before are not used by this one */
+		for (i = 0; i < index; ++i) {
+			close(worker[i-index].jobs);
+			close(worker[i-index].results);
+		}
+		close(jobs[1]);
+		close(results[0]);
+		if (dup2(results[1], STDOUT_FILENO) == -1 || dup2(results[1], STDERR_FILENO) == -1) {
+			_exit(EXIT_FAILURE);
+		}
+		close(results[1]);
+		_exit(run_batch_worker(jobs[0]));
+	}
+	close(jobs[0]);
+	close(results[1]);
+	worker->jobs = jobs[1];
+	worker->results = results[0];
+	worker->instance = -1;
+	worker->output = NULL;
+	worker->output_size = 0;
+	worker->output_max = 0;
+	return 1;
+}
+
+/* Worker process, reads cities (size then text) from the jobs pipe until it is closed. */
+/* Each output ends with a null character so that the parent knows when it is complete. */
+
+static int run_batch_worker(int jobs) {
+	int size;
+	while (read_fd(jobs, &size, sizeof(int))) {
+		double start;
+		int status;
+		if ((size_t)size > batch_max) {
+			char *batch_input_tmp = realloc(batch_input, (size_t)size);
+			if (!batch_input_tmp) {
+				return EXIT_FAILURE;
+			}
+			batch_input = batch_input_tmp;
+			batch_max = (size_t)size;
+		}
+		if (!read_fd(jobs, batch_input, (size_t)size)) {
+			return EXIT_FAILURE;
+		}
+		start = get_time();
+		input = fmemopen(batch_input, (size_t)size, "r");
+		if (input) {
+			status = solve();
+			fclose(input);
+		}
+		else {
+			fputs("Cannot open batch instance\n", stderr);
+			fflush(stderr);
+			status = EXIT_FAILURE;
+		}
+		printf("Status %s\nSeconds %.6f\n", status == EXIT_SUCCESS ? "ok":"error", get_time()-start);
+		putchar('\0');
+		fflush(stdout);
+	}
+	free_data();
+	if (batch_input) {
+		free(batch_input);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Copies the next city from standard input to the batch input buffer, the layout is */
+/* checked only to find where the city ends, returns 0 at the end of input and -1 if invalid */
+
+static int read_batch_instance(void) {
+	long n_streets;
+	int c, i;
+	batch_size = 0;
+	do {
+		c = getchar();
+	}
+	while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+	if (c == EOF) {
+		return 0;
+	}
+	ungetc(c, stdin);
+	if (!copy_batch_token(&n_streets) || n_streets < 1 || n_streets > 0x3fffffffL) {
+		return -1;
+	}
+	for (i = 0; i < 3 && copy_batch_token(NULL); ++i);
+	if (i < 3) {
+		return -1;
+	}
+	for (i = (int)n_streets*2; i--; ) {
+		if (!copy_batch_line()) {
+			return -1;
+		}
+	}
+	return copy_batch_token(NULL) && copy_batch_token(NULL) ? 1:-1;
+}
+
+static int copy_batch_token(long *value) {
+	size_t token;
+	int c;
+	for (c = getchar(); c == ' ' || c == '\t' || c == '\n' || c == '\r'; c = getchar()) {
+		if (!add_batch_char(c)) {
+			return 0;
+		}
+	}
+	token = batch_size;
+	for (; c != EOF && c != ' ' && c != '\t' && c != '\n' && c != '\r'; c = getchar()) {
+		if (!add_batch_char(c)) {
+			return 0;
+		}
+	}
+	if (c != EOF) {
+		ungetc(c, stdin);
+	}
+	if (token == batch_size) {
+		return 0;
+	}
+	if (value) {
+		char *end;
+		batch_input[batch_size] = '\0';
+		*value = strtol(batch_input+token, &end, 10);
+		return !*end;
+	}
+	return 1;
+}
+
+/* Copies the end of the current line */
+
+static int copy_batch_line(void) {
+	int c;
+	for (c = getchar(); c != '\n' && c != EOF; c = getchar()) {
+		if (!add_batch_char(c)) {
+			return 0;
+		}
+	}
+	return c != EOF && add_batch_char(c);
+}
+
+static int add_batch_char(int c) {
+
+	/* One more character is kept available to terminate a token */
+	if (batch_size+1 >= batch_max) {
+		char *batch_input_tmp = realloc(batch_input, batch_max+BATCH_READ_SIZE);
+		if (!batch_input_tmp) {
+			fputs("Cannot reallocate memory for batch input\n", stderr);
+			fflush(stderr);
+			return 0;
+		}
+		batch_input = batch_input_tmp;
+		batch_max += BATCH_READ_SIZE;
+	}
+	batch_input[batch_size++] = (char)c;
+	return 1;
+}
+
+static void send_batch_instance(batch_worker_t *worker, int instance) {
+	int size = (int)batch_size;
+	if (instance == max_batch_outputs) {
+		char **batch_outputs_tmp = realloc(batch_outputs, sizeof(char *)*(size_t)(max_batch_outputs+BATCH_READ_SIZE));
+		if (!batch_outputs_tmp) {
+			fputs("Cannot reallocate memory for batch outputs\n", stderr);
+			fflush(stderr);
+			batch_end = -1;
+			return;
+		}
+		batch_outputs = batch_outputs_tmp;
+		max_batch_outputs += BATCH_READ_SIZE;
+	}
+	batch_outputs[instance] = NULL;
+	++n_batch_instances;
+	worker->instance = instance;
+	if (!write_fd(worker->jobs, &size, sizeof(int)) || !write_fd(worker->jobs, batch_input, batch_size)) {
+		if (end_batch_crashed(worker) > 0) {
+			end_batch_instance(worker);
+		}
+		else {
+			batch_end = -1;
+		}
+	}
+}
+
+/* Reads what the worker has written so far, returns 1 when its output for the current city is complete */
+
+static int read_batch_output(batch_worker_t *worker) {
+	char buffer[BATCH_READ_SIZE];
+	ssize_t n = read(worker->results, buffer, sizeof(buffer));
+	if (n <= 0) {
+		return end_batch_crashed(worker);
+	}
+	if (!add_batch_output(worker, buffer, (size_t)n)) {
+		return -1;
+	}
+	return worker->output[worker->output_size-1] == '\0';
+}
+
+static int add_batch_output(batch_worker_t *worker, const char *buffer, size_t size) {
+	if (worker->output_size+size > worker->output_max) {
+		char *output_tmp = realloc(worker->output, worker->output_size+size+BATCH_READ_SIZE);
+		if (!output_tmp) {
+			fputs("Cannot reallocate memory for batch output\n", stderr);
+			fflush(stderr);
+			return 0;
+		}
+		worker->output = output_tmp;
+		worker->output_max = worker->output_size+size+BATCH_READ_SIZE;
+	}
+	memcpy(worker->output+worker->output_size, buffer, size);
+	worker->output_size += size;
+	return 1;
+}
+
+/* The worker is gone, the city it was solving is reported as failed */
+
+static int end_batch_crashed(batch_worker_t *worker) {
+	stop_batch_worker(worker);
+	return add_batch_output(worker, "Status crashed\n", sizeof("Status crashed\n")) ? 1:-1;
+}
+
+/* The output becomes owned by the outputs waiting to be printed */
+
+static void end_batch_instance(batch_worker_t *worker) {
+	batch_outputs[worker->instance] = worker->output;
+	worker->instance = -1;
+	worker->output = NULL;
+	worker->output_size = 0;
+	worker->output_max = 0;
+}
+
+static void stop_batch_worker(batch_worker_t *worker) {
+	if (worker->pid > 0) {
+		close(worker->jobs);
+		close(worker->results);
+		waitpid(worker->pid, NULL, 0);
+		worker->pid = 0;
+	}
+}
+
+static void print_batch_outputs(void) {
+	while (n_batch_printed < n_batch_instances && batch_outputs[n_batch_printed]) {
+		printf("Instance %d\n", n_batch_printed+1);
+		fputs(batch_outputs[n_batch_printed], stdout);
+		if (!strstr(batch_outputs[n_batch_printed], "Status ok\n")) {
+			batch_status = EXIT_FAILURE;
+		}
+		free(batch_outputs[n_batch_printed]);
+		batch_outputs[n_batch_printed++] = NULL;
+	}
+	fflush(stdout);
+}
+
+static int read_fd(int fd, void *buffer, size_t size) {
+	char *position = buffer;
+	while (size) {
+		ssize_t n = read(fd, position, size);
+		if (n <= 0) {
+			return 0;
+		}
+		position += n;
+		size -= (size_t)n;
+	}
+	return 1;
+}
+
+static int write_fd(int fd, const void *buffer, size_t size) {
+	const char *position = buffer;
+	while (size) {
+		ssize_t n = write(fd, position, size);
+		if (n <= 0) {
+			return 0;
+		}
+		position += n;
+		size -= (size_t)n;
+	}
+	return 1;
+}
+
+/* Threads sharing the BFSes of one bound computation, the main thread is thread 0. */
+/* They are only woken up when the BFSes may visit at least BFS_THREADS_WORK_MIN nodes in total. */
+/* Each thread has its own queue and marks the nodes it visits with a stamp in its own array, */
+/* the path being measured is excluded explicitly so that the shared graph is only read. */
+
+static int start_bfs_threads(void) {
+	int max_to_paths = 0, i;
+	for (i = 0; i < n_nodes; ++i) {
+		if (nodes[i].n_to_paths > max_to_paths) {
+			max_to_paths = nodes[i].n_to_paths;
+		}
+	}
+	bfs_threads = calloc((size_t)n_threads, sizeof(bfs_thread_t));
+	bfs_candidates = malloc(sizeof(path_t *)*(size_t)(max_to_paths+1));
+	bfs_results = malloc(sizeof(int)*(size_t)(max_to_paths+1));
+	bfs_expanded = malloc(sizeof(int)*(size_t)(max_to_paths+1));
+	if (!bfs_threads || !bfs_candidates || !bfs_results || !bfs_expanded) {
+		fputs("Cannot allocate memory for threads\n", stderr);
+		fflush(stderr);
+		stop_bfs_threads(0);
+		return 0;
+	}
+	for (i = 0; i < n_threads; ++i) {
+		bfs_threads[i].index = i;
+		bfs_threads[i].stamps = calloc((size_t)n_nodes, sizeof(int));
+		bfs_threads[i].distances = malloc(sizeof(int)*(size_t)n_nodes);
+		bfs_threads[i].queue = malloc(sizeof(node_t *)*(size_t)n_nodes);
+		if (!bfs_threads[i].stamps || !bfs_threads[i].distances || !bfs_threads[i].queue) {
+			fputs("Cannot allocate memory for thread queues\n", stderr);
+			fflush(stderr);
+			stop_bfs_threads(0);
+			return 0;
+		}
+	}
+	bfs_generation = 0;
+	bfs_quit = 0;
+	pthread_mutex_init(&bfs_mutex, NULL);
+	pthread_cond_init(&bfs_start_cond, NULL);
+	pthread_cond_init(&bfs_done_cond, NULL);
+	for (i = 1; i < n_threads && !pthread_create(&bfs_threads[i].thread, NULL, run_bfs_thread, bfs_threads+i); ++i);
+	if (i < n_threads) {
+		fputs("Cannot create thread\n", stderr);
+		fflush(stderr);
+		stop_bfs_threads(i);
+		return 0;
+	}
+	return 1;
+}
+
+/* Stops the n_started first threads (the main thread included) and frees the thread data */
+
+static void stop_bfs_threads(int n_started) {
+	int i;
+	if (n_started) {
+		pthread_mutex_lock(&bfs_mutex);
+		bfs_quit = 1;
+		pthread_cond_broadcast(&bfs_start_cond);
+		pthread_mutex_unlock(&bfs_mutex);
+		for (i = 1; i < n_started; ++i) {
+			pthread_join(bfs_threads[i].thread, NULL);
+		}
+		pthread_cond_destroy(&bfs_done_cond);
+		pthread_cond_destroy(&bfs_start_cond);
+		pthread_mutex_destroy(&bfs_mutex);
+	}
+	if (bfs_threads) {
+		for (i = 0; i < n_threads; ++i) {
+			free(bfs_threads[i].queue);
+			free(bfs_threads[i].distances);
+			free(bfs_threads[i].stamps);
+		}
+		free(bfs_threads);
+		bfs_threads = NULL;
+	}
+	if (bfs_expanded) {
+		free(bfs_expanded);
+		bfs_expanded = NULL;
+	}
+	if (bfs_results) {
+		free(bfs_results);
+		bfs_results = NULL;
+	}
+	if (bfs_candidates) {
+		free(bfs_candidates);
+		bfs_candidates = NULL;
+	}
+}
+
+static void *run_bfs_thread(void *arg) {
+	int generation = 0;
+	bfs_thread_t *thread = arg;
+	pthread_mutex_lock(&bfs_mutex);
+	while (1) {
+		while (bfs_generation == generation && !bfs_quit) {
+			pthread_cond_wait(&bfs_start_cond, &bfs_mutex);
+		}
+		if (bfs_quit) {
+			break;
+		}
+		generation = bfs_generation;
+		pthread_mutex_unlock(&bfs_mutex);
+		run_bfs_tasks(thread);
+		pthread_mutex_lock(&bfs_mutex);
+		if (!--n_bfs_running) {
+			pthread_cond_signal(&bfs_done_cond);
+		}
+	}
+	pthread_mutex_unlock(&bfs_mutex);
+	return NULL;
+}
+
+/* Runs one BFS per task on all threads and waits until they are all done */
+
+static void run_bfs_job(int job, node_t *start, path_t **tasks, int n_tasks, int distance) {
+	int i;
+	pthread_mutex_lock(&bfs_mutex);
+	bfs_job = job;
+	bfs_start = start;
+	bfs_tasks = tasks;
+	n_bfs_tasks = n_tasks;
+	bfs_distance = distance;
+	++bfs_generation;
+	n_bfs_running = n_threads-1;
+	pthread_cond_broadcast(&bfs_start_cond);
+	pthread_mutex_unlock(&bfs_mutex);
+	run_bfs_tasks(bfs_threads);
+	pthread_mutex_lock(&bfs_mutex);
+	while (n_bfs_running) {
+		pthread_cond_wait(&bfs_done_cond, &bfs_mutex);
+	}
+	pthread_mutex_unlock(&bfs_mutex);
+	for (i = 0; i < n_threads; ++i) {
+		stats.bfs_expansions[job] += bfs_threads[i].expansions;
+		bfs_threads[i].expansions = 0;
+	}
+}
+
+static void run_bfs_tasks(bfs_thread_t *thread) {
+	int i;
+	for (i = thread->index; i < n_bfs_tasks; i += n_threads) {
+		if (bfs_job == BFS_SET_DISTANCES) {
+			set_thread_distances(thread, bfs_start, bfs_tasks[i]);
+			if (bfs_tasks[i]->reverse) {
+				set_thread_distances(thread, bfs_start, bfs_tasks[i]->reverse);
+			}
+		}
+		else {
+			bfs_results[i] = get_thread_distance(thread, bfs_start, bfs_tasks[i], bfs_distance, bfs_expanded+i);
+		}
+	}
+}
+
+/* Same as set_distances */
+
+static void set_thread_distances(bfs_thread_t *thread, node_t *start, path_t *path) {
+	int stamp = get_thread_stamp(thread), start_index = (int)(start-nodes), n_queue = 1, i, j;
+	node_t **queue = thread->queue;
+	queue[0] = path->to;
+	thread->stamps[path->to-nodes] = stamp;
+	thread->distances[path->to-nodes] = 0;
+	for (i = 0; i < n_queue && !add_thread_nodes(thread, path, path->edge, queue[i], &n_queue, 1); ++i);
+	if (i < n_queue) {
+		path->distance_next = thread->distances[queue[i]-nodes];
+		path->to_start = 0;
+		for (j = i; j < n_queue && thread->stamps[start_index] != stamp; ++j) {
+			add_thread_nodes(thread, path, path->edge, queue[j], &n_queue, 0);
+		}
+		thread->expansions += (unsigned long)j;
+	}
+	else {
+		thread->expansions += (unsigned long)i;
+	}
+	path->distance_start = thread->stamps[start_index] == stamp ? thread->distances[start_index]:-1;
+	if (i == n_queue) {
+		path->distance_next = path->distance_start;
+		path->to_start = 1;
+	}
+}
+
+/* Same as the BFS of add_path_calls2, returns -1 if the candidate is not evaluated. The nodes expanded are */
+/* returned apart, they are only counted if the candidate is still evaluated when the results are merged */
+
+static int get_thread_distance(bfs_thread_t *thread, node_t *start, path_t *evaluated, int distance, int *n_expanded) {
+	int stamp = get_thread_stamp(thread), n_queue = 1, i;
+	node_t **queue = thread->queue;
+	queue[0] = evaluated->to;
+	thread->stamps[evaluated->to-nodes] = stamp;
+	thread->distances[evaluated->to-nodes] = distance;
+	for (i = 0; i < n_queue && (low_bound || queue[i] != start) && !add_thread_nodes(thread, evaluated, NULL, queue[i], &n_queue, 1); ++i);
+	*n_expanded = i < n_queue ? i+1:i;
+	if (i < n_queue) {
+		return thread->distances[queue[i]-nodes];
+	}
+	return min_q_paths <= n_paths ? -1:thread->distances[queue[n_queue-1]-nodes];
+}
+
+/* Adds the nodes reached from a node by paths other than the excluded one, */
+/* returns 1 if a path still to visit is found and targets are searched */
+
+static int add_thread_nodes(bfs_thread_t *thread, const path_t *excluded, const edge_t *excluded_edge, node_t *from, int *n_queue, int targets) {
+	int stamp = thread->stamp, i;
+	for (i = 0; i < from->n_to_paths; ++i) {
+		path_t *path = from->to_paths+i;
+		if (!path->visited && path != excluded) {
+			int to = (int)(path->to-nodes);
+			if (targets && path->edge && (manhattan || (!path->edge->visited && path->edge != excluded_edge))) {
+				return 1;
+			}
+			if (thread->stamps[to] != stamp) {
+				thread->stamps[to] = stamp;
+				thread->distances[to] = thread->distances[from-nodes]+1;
+				thread->queue[(*n_queue)++] = path->to;
+			}
+		}
+	}
+	return 0;
+}
+
+static int get_thread_stamp(bfs_thread_t *thread) {
+	if (thread->stamp == BFS_STAMP_MAX) {
+		memset(thread->stamps, 0, sizeof(int)*(size_t)n_nodes);
+		thread->stamp = 0;
+	}
+	return ++thread->stamp;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Benchmark matrix: square cities generated with a fixed seed, solved in both modes for each number of choices.
+# Each run is stopped after BENCH_TIMEOUT seconds, counters are then taken from the last statistics snapshot.
+
+SIZES="5 10 20 40 80"
+MODES="0 1"
+CHOICES="1 2 4"
+SEED=${BENCH_SEED:-1}
+TIMEOUT=${BENCH_TIMEOUT:-10}
+TMP_DIR=$(mktemp -d)
+trap 'rm -rf "$TMP_DIR"' EXIT
+
+printf "size\tmanhattan\tn_choices\tstatus\tseconds\tnodes_expanded\tlength\tvalid\n"
+for size in $SIZES; do
+	for manhattan in $MODES; do
+		for n_choices in $CHOICES; do
+			city="$TMP_DIR/city.txt"
+			output="$TMP_DIR/output.txt"
+			stats="$TMP_DIR/stats.json"
+			if ! ./sweepnyc_gen "$size" "$size" "$SEED" 60 30 10 "$manhattan" "$n_choices" > "$city" 2> /dev/null; then
+				printf "%s\t%s\t%s\tgenerator_error\t-\t-\t-\t-\n" "$size" "$manhattan" "$n_choices"
+				continue
+			fi
+			rm -f "$stats"
+			timeout "$TIMEOUT" ./sweepnyc -s "$stats" -S 1000 < "$city" > "$output" 2>&1
+			case $? in
+			0) status=ok ;;
+			124) status=timeout ;;
+			*) status=error ;;
+			esac
+			if [ -s "$stats" ]; then
+				if [ $status = timeout ]; then
+					seconds=$TIMEOUT
+				else
+					seconds=$(tail -n 1 "$stats" | sed 's/.*"elapsed":\([0-9.]*\).*/\1/')
+				fi
+				nodes=$(tail -n 1 "$stats" | awk -F'"bfs_expansions":{' '{ split($2, counters, /[,:}]/); print counters[2]+counters[4]+counters[6]+counters[8] }')
+			else
+				seconds=$TIMEOUT
+				nodes=-
+			fi
+			length=$(awk '$1 == "Length" { length_found = $2 } END { print length_found == "" ? "-":length_found }' "$output")
+			if ./sweepnyc_check "$city" < "$output" > /dev/null 2>&1; then
+				valid=yes
+			else
+				valid=no
+			fi
+			printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "$size" "$manhattan" "$n_choices" "$status" "$seconds" "$nodes" "$length" "$valid"
+		done
+	done
+done
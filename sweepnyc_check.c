@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOKEN_SIZE_MAX 32
+#define N_DIRECTIONS 4
+#define DIRECTION_NORTH 0
+#define DIRECTION_SOUTH 1
+#define DIRECTION_WEST 2
+#define DIRECTION_EAST 3
+
+static int read_city(FILE *);
+static int read_line(FILE *, char *, int);
+static int add_circuit_node(const char *);
+static const char *check_circuit(int);
+static const char *check_step(int, int);
+static void free_data(void);
+
+static int n_streets, n_avenues, start, any_start, manhattan, n_circuit_nodes, max_circuit_nodes;
+static int *circuit_nodes = NULL, *walks = NULL;
+static char *horizontal_edges = NULL, *vertical_edges = NULL;
+
+int main(int argc, char *argv[]) {
+	char token[TOKEN_SIZE_MAX];
+	int n_circuits = 0, n_invalid = 0, in_circuit = 0;
+	FILE *city;
+	any_start = argc == 3 && !strcmp(argv[1], "-a");
+	if (argc != 2+any_start) {
+		fputs("Usage: sweepnyc_check [-a] city_file < solver_output\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	city = fopen(argv[1+any_start], "r");
+	if (!city) {
+		fputs("Cannot open city file\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (!read_city(city)) {
+		fclose(city);
+		free_data();
+		return EXIT_FAILURE;
+	}
+	fclose(city);
+	n_circuit_nodes = 0;
+	max_circuit_nodes = 0;
+	while (scanf("%31s", token) == 1) {
+		if (!strcmp(token, "Circuit")) {
+			n_circuit_nodes = 0;
+			in_circuit = 1;
+		}
+		else if (!strcmp(token, "Length")) {
+			int length;
+			const char *error;
+			if (!in_circuit || scanf("%d", &length) != 1) {
+				fputs("Invalid solver output\n", stderr);
+				fflush(stderr);
+				free_data();
+				return EXIT_FAILURE;
+			}
+			++n_circuits;
+			error = check_circuit(length);
+			if (error) {
+				printf("Circuit %d length %d invalid: %s\n", n_circuits, length, error);
+				++n_invalid;
+			}
+			else {
+				printf("Circuit %d length %d valid\n", n_circuits, length);
+			}
+			in_circuit = 0;
+		}
+		else if (in_circuit && !add_circuit_node(token)) {
+			free_data();
+			return EXIT_FAILURE;
+		}
+	}
+	if (!n_circuits) {
+		puts("No circuit found");
+	}
+	fflush(stdout);
+	free_data();
+	return n_circuits && !n_invalid ? EXIT_SUCCESS:EXIT_FAILURE;
+}
+
+static int read_city(FILE *city) {
+	int start_street, start_avenue, line_size, i, j;
+	char *line;
+	if (fscanf(city, "%d%d%d%d", &n_streets, &n_avenues, &start_street, &start_avenue) != 4 || n_streets < 1 || n_avenues < 1 || start_street < 1 || start_street > n_streets || start_avenue < 1 || start_avenue > n_avenues) {
+		fputs("Invalid city header\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	while ((i = getc(city)) != '\n' && i != EOF);
+	start = (start_street-1)*n_avenues+start_avenue-1;
+	horizontal_edges = malloc((size_t)(n_streets*n_avenues));
+	vertical_edges = malloc((size_t)(n_streets*n_avenues));
+	walks = calloc((size_t)(n_streets*n_avenues*N_DIRECTIONS), sizeof(int));
+	line_size = n_avenues*4;
+	line = malloc((size_t)line_size+1);
+	if (!horizontal_edges || !vertical_edges || !walks || !line) {
+		fputs("Cannot allocate memory for city\n", stderr);
+		fflush(stderr);
+		free(line);
+		return 0;
+	}
+	for (i = 0; i < n_streets; ++i) {
+		if (i) {
+			if (!read_line(city, line, line_size)) {
+				free(line);
+				return 0;
+			}
+			for (j = 0; j < n_avenues; ++j) {
+				vertical_edges[(i-1)*n_avenues+j] = line[j*4];
+			}
+		}
+		if (!read_line(city, line, line_size)) {
+			free(line);
+			return 0;
+		}
+		for (j = 0; j < n_avenues; ++j) {
+			if (line[j*4] != 'o') {
+				fputs("Invalid node\n", stderr);
+				fflush(stderr);
+				free(line);
+				return 0;
+			}
+			horizontal_edges[i*n_avenues+j] = line[j*4+2];
+			vertical_edges[i*n_avenues+j] = 'o';
+		}
+		horizontal_edges[i*n_avenues+n_avenues-1] = 'o';
+	}
+	free(line);
+	if (fscanf(city, "%d", &manhattan) != 1 || manhattan < 0 || manhattan > 1) {
+		fputs("Invalid Manhattan flag\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	return 1;
+}
+
+/* Reads one line of the city grid, padding it with blanks up to line_size characters */
+
+static int read_line(FILE *city, char *line, int line_size) {
+	int c, i;
+	for (i = 0; (c = getc(city)) != '\n' && c != EOF; ++i) {
+		if (i < line_size) {
+			line[i] = (char)c;
+		}
+	}
+	if (c == EOF) {
+		fputs("Unexpected end of city\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	for (; i < line_size; ++i) {
+		line[i] = ' ';
+	}
+	return 1;
+}
+
+static int add_circuit_node(const char *token) {
+	int street, avenue;
+	char end;
+	if (sscanf(token, "S%d/A%d%c", &street, &avenue, &end) != 2 || street < 1 || street > n_streets || avenue < 1 || avenue > n_avenues) {
+		fputs("Invalid circuit node\n", stderr);
+		fflush(stderr);
+		return 0;
+	}
+	if (n_circuit_nodes == max_circuit_nodes) {
+		int *circuit_nodes_tmp = realloc(circuit_nodes, sizeof(int)*(size_t)(max_circuit_nodes+n_streets*n_avenues));
+		if (!circuit_nodes_tmp) {
+			fputs("Cannot reallocate memory for circuit nodes\n", stderr);
+			fflush(stderr);
+			return 0;
+		}
+		circuit_nodes = circuit_nodes_tmp;
+		max_circuit_nodes += n_streets*n_avenues;
+	}
+	circuit_nodes[n_circuit_nodes++] = (street-1)*n_avenues+avenue-1;
+	return 1;
+}
+
+/* Checks that the circuit starts and ends at the start node (any node with -a), walks edges in legal directions and covers all edges (arcs in Manhattan mode) */
+
+static const char *check_circuit(int length) {
+	int i;
+	const char *error;
+	if (!n_circuit_nodes || (!any_start && circuit_nodes[0] != start) || circuit_nodes[n_circuit_nodes-1] != circuit_nodes[0]) {
+		return "circuit does not start and end at start node";
+	}
+	if (length != n_circuit_nodes-1) {
+		return "length does not match the number of steps";
+	}
+	memset(walks, 0, sizeof(int)*(size_t)(n_streets*n_avenues*N_DIRECTIONS));
+	for (i = 1; i < n_circuit_nodes; ++i) {
+		error = check_step(circuit_nodes[i-1], circuit_nodes[i]);
+		if (error) {
+			return error;
+		}
+	}
+	for (i = 0; i < n_streets*n_avenues; ++i) {
+		const int *node_walks = walks+i*N_DIRECTIONS;
+		switch (horizontal_edges[i]) {
+		case '-':
+			if (manhattan ? !node_walks[DIRECTION_EAST] || !walks[(i+1)*N_DIRECTIONS+DIRECTION_WEST]:!node_walks[DIRECTION_EAST] && !walks[(i+1)*N_DIRECTIONS+DIRECTION_WEST]) {
+				return "street not covered";
+			}
+			break;
+		case '<':
+			if (!walks[(i+1)*N_DIRECTIONS+DIRECTION_WEST]) {
+				return "street not covered";
+			}
+			break;
+		case '>':
+			if (!node_walks[DIRECTION_EAST]) {
+				return "street not covered";
+			}
+			break;
+		default:
+			break;
+		}
+		switch (vertical_edges[i]) {
+		case '|':
+			if (manhattan ? !node_walks[DIRECTION_SOUTH] || !walks[(i+n_avenues)*N_DIRECTIONS+DIRECTION_NORTH]:!node_walks[DIRECTION_SOUTH] && !walks[(i+n_avenues)*N_DIRECTIONS+DIRECTION_NORTH]) {
+				return "avenue not covered";
+			}
+			break;
+		case '^':
+			if (!walks[(i+n_avenues)*N_DIRECTIONS+DIRECTION_NORTH]) {
+				return "avenue not covered";
+			}
+			break;
+		case 'v':
+			if (!node_walks[DIRECTION_SOUTH]) {
+				return "avenue not covered";
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* Records the walk from node a to node b, each walk is counted at its origin node */
+
+static const char *check_step(int a, int b) {
+	int delta = b-a, type;
+	if (delta == n_avenues || delta == -n_avenues) {
+		type = vertical_edges[b < a ? b:a];
+		if (type == 'o' || (type == '^' && b > a) || (type == 'v' && b < a)) {
+			return "avenue walked illegally";
+		}
+		++walks[a*N_DIRECTIONS+(b < a ? DIRECTION_NORTH:DIRECTION_SOUTH)];
+		return NULL;
+	}
+	if ((delta == 1 || delta == -1) && a/n_avenues == b/n_avenues) {
+		type = horizontal_edges[b < a ? b:a];
+		if (type == 'o' || (type == '>' && b < a) || (type == '<' && b > a)) {
+			return "street walked illegally";
+		}
+		++walks[a*N_DIRECTIONS+(b < a ? DIRECTION_WEST:DIRECTION_EAST)];
+		return NULL;
+	}
+	return "nodes not adjacent";
+}
+
+static void free_data(void) {
+	if (circuit_nodes) {
+		free(circuit_nodes);
+	}
+	if (walks) {
+		free(walks);
+	}
+	if (vertical_edges) {
+		free(vertical_edges);
+	}
+	if (horizontal_edges) {
+		free(horizontal_edges);
+	}
+}
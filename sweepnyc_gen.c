@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RANDOM_MASK 0xffffffffUL
+#define VISITED_FORWARD 1
+#define VISITED_BACKWARD 2
+#define VISITED_GRID 4
+#define N_SIDES 4
+
+typedef struct node_s {
+	int street;
+	int avenue;
+	int visited;
+	struct node_s *from;
+}
+node_t;
+
+static int parse_int(const char *, int, int *);
+static unsigned long get_random(void);
+static int get_edge_type(const int *);
+static void generate_city(void);
+static void connect_city(void);
+static int is_open_node(const node_t *);
+static void set_reachable(int);
+static void add_q_node(node_t *, int, int);
+static node_t *get_neighbour(const node_t *, int);
+static void open_path(node_t *);
+static int get_edge(int, int, int, int);
+static int check_step(int, int, int, int);
+static void print_city(void);
+
+static int n_streets, n_avenues, shares[3], manhattan, n_choices, start_street, start_avenue, n_q_nodes;
+static char *horizontal_edges = NULL, *vertical_edges = NULL;
+static node_t *nodes = NULL, **q_nodes = NULL;
+static unsigned long random_state;
+
+int main(int argc, char *argv[]) {
+	int seed, i;
+	if (argc != 9) {
+		fputs("Usage: sweepnyc_gen n_streets n_avenues seed two_way_share one_way_share blocked_share manhattan n_choices\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (!parse_int(argv[1], 1, &n_streets) || !parse_int(argv[2], 1, &n_avenues)) {
+		fputs("Invalid city size\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (!parse_int(argv[3], 0, &seed)) {
+		fputs("Invalid seed\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < 3 && parse_int(argv[i+4], 0, shares+i); ++i);
+	if (i < 3 || shares[0]+shares[1]+shares[2] < 1 || shares[0]+shares[1] < 1) {
+		fputs("Invalid edge shares\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (!parse_int(argv[7], 0, &manhattan) || manhattan > 1) {
+		fputs("Invalid Manhattan flag\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	if (!parse_int(argv[8], 1, &n_choices) || n_choices > 4) {
+		fputs("Invalid number of choices\n", stderr);
+		fflush(stderr);
+		return EXIT_FAILURE;
+	}
+	horizontal_edges = malloc((size_t)(n_streets*n_avenues));
+	vertical_edges = malloc((size_t)(n_streets*n_avenues));
+	nodes = malloc(sizeof(node_t)*(size_t)(n_streets*n_avenues));
+	q_nodes = malloc(sizeof(node_t *)*(size_t)(n_streets*n_avenues));
+	if (!horizontal_edges || !vertical_edges || !nodes || !q_nodes) {
+		fputs("Cannot allocate memory for city\n", stderr);
+		fflush(stderr);
+		free(q_nodes);
+		free(nodes);
+		free(vertical_edges);
+		free(horizontal_edges);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < n_streets*n_avenues; ++i) {
+		nodes[i].street = i/n_avenues;
+		nodes[i].avenue = i%n_avenues;
+		nodes[i].visited = 0;
+	}
+	random_state = (unsigned long)seed*2654435761UL+1UL;
+	generate_city();
+	connect_city();
+	print_city();
+	free(q_nodes);
+	free(nodes);
+	free(vertical_edges);
+	free(horizontal_edges);
+	return EXIT_SUCCESS;
+}
+
+static int parse_int(const char *str, int min, int *value) {
+	char *end;
+	long value_read = strtol(str, &end, 10);
+	if (end == str || *end || value_read < min || value_read > 0x7fffffffL) {
+		return 0;
+	}
+	*value = (int)value_read;
+	return 1;
+}
+
+/* Xorshift generator, gives the same city for a given seed on every platform */
+
+static unsigned long get_random(void) {
+	random_state ^= (random_state << 13) & RANDOM_MASK;
+	random_state ^= random_state >> 17;
+	random_state ^= (random_state << 5) & RANDOM_MASK;
+	return random_state;
+}
+
+static int get_edge_type(const int *types) {
+	unsigned long draw = get_random()%(unsigned long)(shares[0]+shares[1]+shares[2]);
+	if (draw < (unsigned long)shares[0]) {
+		return types[0];
+	}
+	if (draw < (unsigned long)(shares[0]+shares[1])) {
+		return get_random()%2 ? types[1]:types[2];
+	}
+	return 'o';
+}
+
+static void generate_city(void) {
+	const int horizontal_types[3] = { '-', '<', '>' }, vertical_types[3] = { '|', '^', 'v' };
+	int i;
+	for (i = 0; i < n_streets*n_avenues; ++i) {
+		horizontal_edges[i] = (char)(nodes[i].avenue < n_avenues-1 ? get_edge_type(horizontal_types):'o');
+		vertical_edges[i] = (char)(nodes[i].street < n_streets-1 ? get_edge_type(vertical_types):'o');
+	}
+	start_street = (int)(get_random()%(unsigned long)n_streets);
+	start_avenue = (int)(get_random()%(unsigned long)n_avenues);
+}
+
+/* Makes every open edge reachable from the start node and able to reach it back, */
+/* by opening in both directions the shortest grid path between an unreachable node and the strongly connected part */
+
+static void connect_city(void) {
+	int i;
+	set_reachable(VISITED_FORWARD);
+	set_reachable(VISITED_BACKWARD);
+	for (i = 0; i < n_streets*n_avenues; ++i) {
+		if (nodes[i].visited != (VISITED_FORWARD | VISITED_BACKWARD) && is_open_node(nodes+i)) {
+			open_path(nodes+i);
+		}
+	}
+}
+
+static int is_open_node(const node_t *node) {
+	int i;
+	for (i = 0; i < N_SIDES; ++i) {
+		node_t *neighbour = get_neighbour(node, i);
+		if (neighbour && get_edge(node->street, node->avenue, neighbour->street, neighbour->avenue) != 'o') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void set_reachable(int visited) {
+	int i;
+	node_t *start = nodes+start_street*n_avenues+start_avenue;
+	if (visited == VISITED_FORWARD) {
+		for (i = 0; i < n_streets*n_avenues; ++i) {
+			nodes[i].visited = 0;
+		}
+	}
+	start->visited |= visited;
+	q_nodes[0] = start;
+	n_q_nodes = 1;
+	for (i = 0; i < n_q_nodes; ++i) {
+		int j;
+		for (j = 0; j < N_SIDES; ++j) {
+			add_q_node(q_nodes[i], j, visited);
+		}
+	}
+}
+
+static void add_q_node(node_t *from, int side, int visited) {
+	node_t *to = get_neighbour(from, side);
+	if (!to || (to->visited & visited)) {
+		return;
+	}
+	if (!(visited == VISITED_FORWARD ? check_step(from->street, from->avenue, to->street, to->avenue):check_step(to->street, to->avenue, from->street, from->avenue))) {
+		return;
+	}
+	to->visited |= visited;
+	q_nodes[n_q_nodes++] = to;
+}
+
+static node_t *get_neighbour(const node_t *node, int side) {
+	int index = node->street*n_avenues+node->avenue;
+	switch (side) {
+	case 0:
+		return node->street ? nodes+index-n_avenues:NULL;
+	case 1:
+		return node->street < n_streets-1 ? nodes+index+n_avenues:NULL;
+	case 2:
+		return node->avenue ? nodes+index-1:NULL;
+	default:
+		return node->avenue < n_avenues-1 ? nodes+index+1:NULL;
+	}
+}
+
+/* Walks the grid from the unreachable node until a strongly connected node is met, */
+/* then opens the edges on the way back - the nodes on the way become strongly connected */
+
+static void open_path(node_t *unreachable) {
+	int i, j;
+	node_t *node;
+	unreachable->visited |= VISITED_GRID;
+	unreachable->from = NULL;
+	q_nodes[0] = unreachable;
+	n_q_nodes = 1;
+	for (i = 0; i < n_q_nodes && (q_nodes[i]->visited & (VISITED_FORWARD | VISITED_BACKWARD)) != (VISITED_FORWARD | VISITED_BACKWARD); ++i) {
+		for (j = 0; j < N_SIDES; ++j) {
+			node_t *neighbour = get_neighbour(q_nodes[i], j);
+			if (neighbour && !(neighbour->visited & (VISITED_GRID))) {
+				neighbour->visited |= VISITED_GRID;
+				neighbour->from = q_nodes[i];
+				q_nodes[n_q_nodes++] = neighbour;
+			}
+		}
+	}
+	for (j = n_q_nodes; j--; ) {
+		q_nodes[j]->visited &= ~VISITED_GRID;
+	}
+	for (node = q_nodes[i]; node->from; node = node->from) {
+		node_t *from = node->from;
+		from->visited = VISITED_FORWARD | VISITED_BACKWARD;
+		if (from->street == node->street) {
+			horizontal_edges[from->street*n_avenues+(from->avenue < node->avenue ? from->avenue:node->avenue)] = '-';
+		}
+		else {
+			vertical_edges[(from->street < node->street ? from->street:node->street)*n_avenues+from->avenue] = '|';
+		}
+	}
+}
+
+/* Returns the type of the edge between two adjacent nodes */
+
+static int get_edge(int street_a, int avenue_a, int street_b, int avenue_b) {
+	if (street_a == street_b) {
+		return horizontal_edges[street_a*n_avenues+(avenue_a < avenue_b ? avenue_a:avenue_b)];
+	}
+	return vertical_edges[(street_a < street_b ? street_a:street_b)*n_avenues+avenue_a];
+}
+
+/* Checks that the edge between two adjacent nodes can be walked from a to b */
+
+static int check_step(int street_a, int avenue_a, int street_b, int avenue_b) {
+	switch (get_edge(street_a, avenue_a, street_b, avenue_b)) {
+	case '-':
+	case '|':
+		return 1;
+	case '<':
+		return avenue_b < avenue_a;
+	case '>':
+		return avenue_b > avenue_a;
+	case '^':
+		return street_b < street_a;
+	case 'v':
+		return street_b > street_a;
+	default:
+		return 0;
+	}
+}
+
+static void print_city(void) {
+	int i, j;
+	printf("%d\n%d\n%d\n%d\n", n_streets, n_avenues, start_street+1, start_avenue+1);
+	for (i = 0; i < n_streets; ++i) {
+		if (i) {
+			for (j = 0; j < n_avenues; ++j) {
+				if (j) {
+					fputs("   ", stdout);
+				}
+				putchar(vertical_edges[(i-1)*n_avenues+j]);
+			}
+			puts("");
+		}
+		for (j = 0; j < n_avenues; ++j) {
+			if (j) {
+				printf(" %c o", horizontal_edges[i*n_avenues+j-1]);
+			}
+			else {
+				putchar('o');
+			}
+		}
+		puts("");
+	}
+	printf("%d\n%d\n", manhattan, n_choices);
+}